@@ -14,11 +14,23 @@ SOURCES += \
     aln/alntypes.cpp \
     aln/frame.cpp \
     aln/channel.cpp \
+    aln/contexttable.cpp \
+    aln/floodfilter.cpp \
+    aln/hashring.cpp \
+    aln/latencywindow.cpp \
     aln/localchannel.cpp \
+    aln/outlierdetector.cpp \
     aln/packet.cpp \
+    aln/pendingqueue.cpp \
     aln/parser.cpp \
+    aln/responsecache.cpp \
     aln/router.cpp \
+    aln/routetable.cpp \
+    aln/servicebalancer.cpp \
+    aln/serviceexecutor.cpp \
+    aln/servicetable.cpp \
     aln/tcpchannel.cpp \
+    aln/telemetry.cpp \
     connectionitemmodel.cpp \
     main.cpp \
     mainwindow.cpp \
@@ -31,11 +43,24 @@ HEADERS += \
     aln/alntypes.h \
     aln/frame.h \
     aln/channel.h \
+    aln/contexttable.h \
+    aln/floodfilter.h \
+    aln/hashring.h \
+    aln/latencywindow.h \
     aln/localchannel.h \
+    aln/outlierdetector.h \
     aln/packet.h \
+    aln/pendingqueue.h \
     aln/parser.h \
+    aln/responsecache.h \
     aln/router.h \
+    aln/routetable.h \
+    aln/servicebalancer.h \
+    aln/serviceexecutor.h \
+    aln/servicetable.h \
     aln/tcpchannel.h \
+    aln/telemetry.h \
+    aln/timerwheel.h \
     connectionitemmodel.h \
     mainwindow.h \
     networkinterfacesitemmodel.h \
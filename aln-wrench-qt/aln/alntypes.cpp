@@ -50,3 +50,7 @@ void writeToBuffer(QBuffer* buffer, QString value) {
     QByteArray utf8 = value.toUtf8();
     buffer->write(utf8);
 }
+
+bool seqNewer(INT16U a, INT16U b) {
+  return (short)(a - b) > 0;
+}
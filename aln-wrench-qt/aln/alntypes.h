@@ -18,4 +18,8 @@ void writeToBuffer(QBuffer* buffer, INT16U value);
 void writeToBuffer(QBuffer* buffer, INT32U value);
 void writeToBuffer(QBuffer* buffer, QString value);
 
+// seqNewer compares 16-bit sequence numbers in serial number arithmetic, so
+// the comparison stays correct across wraparound
+bool seqNewer(INT16U a, INT16U b);
+
 #endif
@@ -0,0 +1,65 @@
+#include "contexttable.h"
+
+#define CONTEXT_TICK_MS 10
+
+ContextTable::ContextTable() : mFreeHead(0), mFreeCount(0), mCount(0), mDeadlines(CONTEXT_TICK_MS) {
+    mSlots.resize(1);
+}
+
+INT16U ContextTable::acquire(PacketHandler* handler, qint64 deadline, qint64 now) {
+    INT16U ctx;
+    bool full = mSlots.size() > CONTEXT_MAX_ID;
+    if (mFreeCount > 0 && (full || now - mSlots[mFree[mFreeHead]].released >= CONTEXT_QUARANTINE_MS)) {
+        // once every id exists the oldest released id is reissued even if quarantined
+        ctx = mFree[mFreeHead];
+        mFreeHead = (mFreeHead + 1) % mFree.size();
+        mFreeCount--;
+    } else if (!full) {
+        ctx = mSlots.size();
+        mSlots.append(Slot());
+    } else {
+        return 0;
+    }
+
+    Slot& slot = mSlots[ctx];
+    slot.handler = handler;
+    slot.used = true;
+    if (deadline > 0)
+        mDeadlines.schedule(deadline, qMakePair(ctx, slot.generation));
+    mCount++;
+    return ctx;
+}
+
+bool ContextTable::release(INT16U ctx, qint64 now) {
+    if (ctx == 0 || ctx >= mSlots.size() || !mSlots[ctx].used)
+        return false;
+    if (mFree.isEmpty())
+        mFree.resize(CONTEXT_MAX_ID);
+    Slot& slot = mSlots[ctx];
+    slot.used = false;
+    slot.handler = nullptr;
+    slot.released = now;
+    slot.generation++;
+    mFree[(mFreeHead + mFreeCount) % mFree.size()] = ctx;
+    mFreeCount++;
+    mCount--;
+    return true;
+}
+
+PacketHandler* ContextTable::handler(INT16U ctx) const {
+    if (ctx >= mSlots.size())
+        return nullptr;
+    return mSlots[ctx].handler;
+}
+
+QList<ContextTable::Context> ContextTable::expire(qint64 now) {
+    QList<Context> expired;
+    foreach (auto timer, mDeadlines.advance(now)) {
+        Slot& slot = mSlots[timer.first];
+        if (slot.generation != timer.second || !slot.used)
+            continue; // released since the deadline was set
+        expired.append(qMakePair(timer.first, slot.handler));
+        release(timer.first, now);
+    }
+    return expired;
+}
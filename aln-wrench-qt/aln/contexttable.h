@@ -0,0 +1,63 @@
+#ifndef CONTEXTTABLE_H
+#define CONTEXTTABLE_H
+
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include "alntypes.h"
+#include "timerwheel.h"
+
+class PacketHandler;
+
+// released context ids are not reissued for this long so late responses to a
+// released context are dropped rather than delivered to its successor
+#ifndef CONTEXT_QUARANTINE_MS
+#define CONTEXT_QUARANTINE_MS 2000
+#endif
+
+#define CONTEXT_MAX_ID 0xFFFF
+
+// ContextTable allocates the 16-bit context ids of request/response exchanges
+// (ALN_PROTOCOL.md section 8.2). Id 0 is reserved. Slots are created on demand
+// up to CONTEXT_MAX_ID and released ids are reissued in FIFO order, so an id is
+// reused as late as possible: not within the quarantine interval unless every
+// id is already in the table.
+//
+// Each slot carries a generation that advances on release; deadline checks in
+// the timer wheel hold the generation they were scheduled for and are ignored
+// once it is stale.
+class ContextTable {
+public:
+    typedef QPair<INT16U, PacketHandler*> Context;
+
+    ContextTable();
+
+    // acquire returns a new context id for handler, or 0 when every id is in use;
+    // a deadline of zero never expires
+    INT16U acquire(PacketHandler* handler, qint64 deadline, qint64 now);
+    bool release(INT16U ctx, qint64 now);
+    bool contains(INT16U ctx) const { return ctx < mSlots.size() && mSlots[ctx].used; }
+    PacketHandler* handler(INT16U ctx) const;
+    // expire releases the contexts whose deadline has passed and returns them
+    QList<Context> expire(qint64 now);
+
+    int size() const { return mCount; }
+    int pendingDeadlines() const { return mDeadlines.size(); }
+
+private:
+    struct Slot {
+        PacketHandler* handler = nullptr;
+        qint64 released = 0;
+        INT16U generation = 0;
+        bool used = false;
+    };
+
+    QVector<Slot> mSlots; // indexed by context id; slot 0 is unused
+    QVector<INT16U> mFree; // ring of released ids, oldest first; allocated on first release
+    int mFreeHead;
+    int mFreeCount;
+    int mCount;
+    TimerWheel<QPair<INT16U, INT16U>> mDeadlines; // (ctx, generation)
+};
+
+#endif // CONTEXTTABLE_H
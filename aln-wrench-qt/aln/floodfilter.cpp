@@ -0,0 +1,48 @@
+#include "floodfilter.h"
+#include "packet.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+FloodFilter::FloodFilter(qint64 windowMs, int capacity)
+    : mWindow(windowMs), mCapacity(capacity), mRotated(0) {}
+
+bool FloodFilter::seen(quint64 fingerprint, qint64 now) {
+    if (now - mRotated >= mWindow || mCurrent.size() >= mCapacity) {
+        if (now - mRotated >= 2 * mWindow)
+            mCurrent.clear(); // idle for more than a window; both generations are stale
+        mPrevious.swap(mCurrent);
+        mCurrent.clear();
+        mRotated = now;
+    }
+    if (mCurrent.contains(fingerprint))
+        return true;
+    mCurrent.insert(fingerprint);
+    return mPrevious.contains(fingerprint);
+}
+
+void FloodFilter::forget(quint64 fingerprint) {
+    mCurrent.remove(fingerprint);
+    mPrevious.remove(fingerprint);
+}
+
+void FloodFilter::clear() {
+    mCurrent.clear();
+    mPrevious.clear();
+}
+
+// fingerprint is a 64-bit FNV-1a hash; collisions drop an update, which the
+// next periodic advertisement repairs
+quint64 FloodFilter::fingerprint(const Packet* packet) {
+    quint64 hash = FNV_OFFSET_BASIS;
+    auto mix = [&hash](unsigned char byte) {
+        hash ^= byte;
+        hash *= FNV_PRIME;
+    };
+    mix((unsigned char)packet->net);
+    mix(packet->seqNum >> 8);
+    mix(packet->seqNum & 0xFF);
+    for (char c : packet->data)
+        mix((unsigned char)c);
+    return hash;
+}
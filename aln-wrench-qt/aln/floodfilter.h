@@ -0,0 +1,38 @@
+#ifndef FLOODFILTER_H
+#define FLOODFILTER_H
+
+#include <QSet>
+#include <QtGlobal>
+
+class Packet;
+
+// FloodFilter remembers the fingerprints of recently seen flooded packets so a
+// copy arriving over a second path is dropped before it is parsed. Fingerprints
+// are held in two generations that rotate every window, or sooner when the
+// current one reaches its capacity, so a fingerprint is remembered for between
+// one and two windows and memory stays bounded at twice the capacity.
+class FloodFilter {
+public:
+    explicit FloodFilter(qint64 windowMs = 5000, int capacity = 4096);
+
+    // seen records fingerprint at now and returns whether it was already recorded
+    bool seen(quint64 fingerprint, qint64 now);
+    // forget drops fingerprint, so the packet is let through when it arrives again
+    void forget(quint64 fingerprint);
+    void setWindow(qint64 windowMs) { mWindow = windowMs; }
+    void clear();
+    int size() const { return mCurrent.size() + mPrevious.size(); }
+
+    // fingerprint hashes the parts of a packet that are the same on every path:
+    // its net state, sequence number and data
+    static quint64 fingerprint(const Packet* packet);
+
+private:
+    qint64 mWindow;
+    int mCapacity;
+    qint64 mRotated;
+    QSet<quint64> mCurrent;
+    QSet<quint64> mPrevious;
+};
+
+#endif // FLOODFILTER_H
@@ -0,0 +1,59 @@
+#include "hashring.h"
+#include <algorithm>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+HashRing::HashRing(const QStringList& addresses, const QVector<short>& loads, int replicas, double balance)
+    : mAddresses(addresses) {
+    double total = 0;
+    for (int i = 0; i < addresses.size(); i++)
+        total += qMax<short>(loads.value(i, 1), 1);
+    double bound = addresses.isEmpty() ? 0 : balance * total / addresses.size();
+    for (int i = 0; i < addresses.size(); i++) {
+        // the least loaded host is at or under the mean, so one is always open
+        mOpen.append(qMax<short>(loads.value(i, 1), 1) <= bound);
+        QByteArray point = addresses.at(i).toUtf8();
+        point.append('#');
+        for (int r = 0; r < replicas; r++)
+            mPoints.append(qMakePair(hash(point + QByteArray::number(r)), i));
+    }
+    std::sort(mPoints.begin(), mPoints.end());
+}
+
+QString HashRing::host(const QByteArray& key) const {
+    return host(key, QSet<QString>());
+}
+
+QString HashRing::host(const QByteArray& key, const QSet<QString>& skip) const {
+    if (mPoints.isEmpty())
+        return QString();
+    auto start = std::lower_bound(mPoints.begin(), mPoints.end(), qMakePair(hash(key), 0));
+    int first = start - mPoints.begin();
+    QString fallback;
+    for (int n = 0; n < mPoints.size(); n++) {
+        int i = mPoints.at((first + n) % mPoints.size()).second;
+        if (!mOpen.at(i))
+            continue;
+        if (!skip.contains(mAddresses.at(i)))
+            return mAddresses.at(i);
+        if (fallback.isEmpty())
+            fallback = mAddresses.at(i);
+    }
+    return fallback.isEmpty() ? mAddresses.at(mPoints.at(first % mPoints.size()).second) : fallback;
+}
+
+quint64 HashRing::hash(const QByteArray& bytes) {
+    quint64 h = FNV_OFFSET_BASIS;
+    for (char c : bytes) {
+        h ^= (unsigned char)c;
+        h *= FNV_PRIME;
+    }
+    // the splitmix64 finalizer
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
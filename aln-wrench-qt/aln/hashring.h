@@ -0,0 +1,42 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+// HashRing assigns keys to the hosts of a service by consistent hashing. Each
+// host is placed at `replicas` points on a ring of 64-bit hashes and a key goes
+// to the host at the first point clockwise from the key's hash, so a host
+// joining or leaving moves only the keys next to its own points. Points are
+// hashed from the address alone, so every node maps a key to the same host.
+//
+// Loads are bounded: a host whose advertised load exceeds `balance` times the
+// mean is passed over and its keys fall to the next host on the ring until its
+// load comes back down.
+class HashRing {
+public:
+    HashRing() {}
+    // loads holds the advertised load of each address, in the same order
+    HashRing(const QStringList& addresses, const QVector<short>& loads, int replicas = 64, double balance = 1.25);
+
+    // host returns the address that key maps to, or an empty string when the ring is empty
+    QString host(const QByteArray& key) const;
+    // host returns the address key maps to when the hosts in skip are passed over
+    // too, unless every host is
+    QString host(const QByteArray& key, const QSet<QString>& skip) const;
+    bool isEmpty() const { return mPoints.isEmpty(); }
+
+    // hash is a 64-bit FNV-1a hash of bytes with a final mix, so keys that
+    // differ in one byte land far apart on the ring
+    static quint64 hash(const QByteArray& bytes);
+
+private:
+    QStringList mAddresses;
+    QVector<bool> mOpen; // under the load bound
+    QVector<QPair<quint64, int>> mPoints; // (hash, index in mAddresses), ascending
+};
+
+#endif // HASHRING_H
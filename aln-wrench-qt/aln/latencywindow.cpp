@@ -0,0 +1,20 @@
+#include "latencywindow.h"
+#include <algorithm>
+
+LatencyWindow::LatencyWindow(int capacity)
+    : mSamples(qMax(capacity, 1), 0.0), mNext(0), mCount(0) {}
+
+void LatencyWindow::add(double ms) {
+    mSamples[mNext] = ms;
+    mNext = (mNext + 1) % mSamples.size();
+    mCount = qMin(mCount + 1, mSamples.size());
+}
+
+double LatencyWindow::percentile(double q, int minimum) const {
+    if (mCount == 0 || mCount < minimum)
+        return -1;
+    QVector<double> sorted = mSamples.mid(0, mCount);
+    int rank = qBound(0, (int)(q * mCount), mCount - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted.at(rank);
+}
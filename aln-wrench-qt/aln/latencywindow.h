@@ -0,0 +1,25 @@
+#ifndef LATENCYWINDOW_H
+#define LATENCYWINDOW_H
+
+#include <QVector>
+
+// LatencyWindow holds the most recent response times of a service, in ms, and
+// reports their percentiles. Once full, each new sample replaces the oldest,
+// so the percentiles follow the service as it speeds up or slows down.
+class LatencyWindow {
+public:
+    explicit LatencyWindow(int capacity = 256);
+
+    void add(double ms);
+    // percentile returns the q quantile (0 to 1) of the samples held, or -1
+    // while there are fewer than minimum of them
+    double percentile(double q, int minimum = 1) const;
+    int size() const { return mCount; }
+
+private:
+    QVector<double> mSamples;
+    int mNext;
+    int mCount;
+};
+
+#endif // LATENCYWINDOW_H
@@ -0,0 +1,155 @@
+#include "outlierdetector.h"
+#include <QVector>
+#include <algorithm>
+
+// the weight of the newest response time in an instance's average
+#define OUTLIER_LATENCY_WEIGHT 0.05
+// response times an instance needs before it can be judged slow
+#define OUTLIER_MIN_SAMPLES 8
+// an instance this close to the median, in ms, is never judged slow
+#define OUTLIER_MIN_SLOW_MS 5
+
+OutlierDetector::OutlierDetector(int failures, double slowFactor, qint64 ejectionMs,
+                                 qint64 maxEjectionMs, double maxEjected)
+    : mFailures(qMax(failures, 1)), mSlowFactor(slowFactor), mEjectionMs(qMax<qint64>(ejectionMs, 1)),
+      mMaxEjectionMs(qMax(maxEjectionMs, ejectionMs)), mMaxEjected(maxEjected) {}
+
+void OutlierDetector::answered(const QString& service, const QString& address, double ms, qint64 now) {
+    QHash<QString, Instance>& instances = mServices[service];
+    Instance& instance = instances[address];
+    instance.failures = 0;
+    if (instance.state == HalfOpen) {
+        // the probe was answered
+        setState(instance, Closed);
+        instance.probing = false;
+    }
+    sample(instances, instance, ms, now);
+}
+
+void OutlierDetector::timedOut(const QString& service, const QString& address, qint64 now) {
+    QHash<QString, Instance>& instances = mServices[service];
+    Instance& instance = instances[address];
+    instance.active = now;
+    instance.failures++;
+    if (instance.state == HalfOpen || (instance.state == Closed && instance.failures >= mFailures))
+        eject(instances, instance, now);
+}
+
+void OutlierDetector::abandoned(const QString& service, const QString& address, double waitedMs, qint64 now) {
+    auto instances = mServices.find(service);
+    if (instances == mServices.end())
+        return;
+    auto it = instances.value().find(address);
+    if (it == instances.value().end())
+        return;
+    it.value().probing = false;
+    if (waitedMs >= 0)
+        sample(instances.value(), it.value(), waitedMs, now);
+}
+
+bool OutlierDetector::isEjected(const QString& service, const QString& address, qint64 now) const {
+    auto instances = mServices.constFind(service);
+    if (instances == mServices.constEnd())
+        return false;
+    auto it = instances.value().constFind(address);
+    if (it == instances.value().constEnd() || it.value().state == Closed)
+        return false;
+    const Instance& instance = it.value();
+    if (instance.state == Open)
+        return now < instance.until;
+    return instance.probing && now < instance.until;
+}
+
+void OutlierDetector::sent(const QString& service, const QString& address, qint64 now) {
+    auto instances = mServices.find(service);
+    if (instances == mServices.end())
+        return;
+    auto it = instances.value().find(address);
+    if (it == instances.value().end())
+        return;
+    Instance& instance = it.value();
+    instance.active = now;
+    if (instance.state == Closed || (instance.state == Open && now < instance.until)
+        || (instance.probing && now < instance.until))
+        return;
+    // the ejection is over and no probe is in flight, or its lease has run out:
+    // this request probes the instance, holding the lease as long as the ejection lasted
+    qint64 lease = qMin(mEjectionMs << qMin(instance.ejections - 1, 20), mMaxEjectionMs);
+    setState(instance, HalfOpen);
+    instance.probing = true;
+    instance.until = now + lease;
+}
+
+void OutlierDetector::prune(qint64 now, qint64 idleMs) {
+    for (auto service = mServices.begin(); service != mServices.end();) {
+        QHash<QString, Instance>& instances = service.value();
+        for (auto it = instances.begin(); it != instances.end();) {
+            if (now - it.value().active >= idleMs && (it.value().state != Open || now >= it.value().until)) {
+                setState(it.value(), Closed);
+                it = instances.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (instances.isEmpty())
+            service = mServices.erase(service);
+        else
+            ++service;
+    }
+}
+
+// sample adds a response time to the instance's average and ejects the
+// instance once it is much slower than the others
+void OutlierDetector::sample(QHash<QString, Instance>& instances, Instance& instance, double ms, qint64 now) {
+    instance.active = now;
+    instance.latency = instance.samples == 0 ? ms : instance.latency + OUTLIER_LATENCY_WEIGHT * (ms - instance.latency);
+    instance.samples++;
+    if (instance.state == Closed && isSlow(instances, instance))
+        eject(instances, instance, now);
+}
+
+// eject takes instance out of service for a back-off that doubles with each
+// ejection in a row, unless too many of the service's instances are out already
+void OutlierDetector::eject(const QHash<QString, Instance>& instances, Instance& instance, qint64 now) {
+    if (instance.state == Closed) {
+        int ejected = 0;
+        for (const Instance& other : instances) {
+            if (other.state != Closed)
+                ejected++;
+        }
+        if (ejected + 1 > (int)(mMaxEjected * instances.size()))
+            return;
+    }
+    instance.ejections++;
+    instance.until = now + qMin(mEjectionMs << qMin(instance.ejections - 1, 20), mMaxEjectionMs);
+    instance.probing = false;
+    instance.failures = 0;
+    instance.samples = 0; // judged afresh once back
+    setState(instance, Open);
+    mEjections++;
+}
+
+void OutlierDetector::setState(Instance& instance, State state) {
+    if ((instance.state == Closed) != (state == Closed))
+        mUnhealthy += state == Closed ? -1 : 1;
+    if (state == Closed && instance.state == HalfOpen && instance.ejections > 0)
+        instance.ejections--; // back-off eases once an instance recovers
+    instance.state = state;
+}
+
+// isSlow returns whether instance answers much slower than the median of the
+// service's other instances in service
+bool OutlierDetector::isSlow(const QHash<QString, Instance>& instances, const Instance& instance) const {
+    if (instance.samples < OUTLIER_MIN_SAMPLES)
+        return false;
+    QVector<double> latencies;
+    for (const Instance& other : instances) {
+        if (&other != &instance && other.state == Closed && other.samples >= OUTLIER_MIN_SAMPLES)
+            latencies.append(other.latency);
+    }
+    if (latencies.isEmpty())
+        return false;
+    std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+    double median = latencies.at(latencies.size() / 2);
+    return instance.latency > mSlowFactor * median && instance.latency - median > OUTLIER_MIN_SLOW_MS;
+}
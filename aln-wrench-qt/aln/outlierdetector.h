@@ -0,0 +1,75 @@
+#ifndef OUTLIERDETECTOR_H
+#define OUTLIERDETECTOR_H
+
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+
+// OutlierDetector tracks the requests answered and timed out by each remote
+// instance of a service and ejects the instances that fail repeatedly or
+// answer much slower than the others, so requests avoid them long before
+// their advertisements are withdrawn.
+//
+// An instance is ejected after `failures` timeouts in a row, or when the moving
+// average of its response time exceeds `slowFactor` times the median of the
+// service's other instances. The ejection lasts a back-off that doubles with
+// each ejection in a row, up to maxEjectionMs. Then one request at a time is let
+// through as a probe: an answer returns the instance to service and a timeout
+// ejects it again. At most maxEjected of a service's tracked instances are
+// ejected at once.
+class OutlierDetector {
+public:
+    OutlierDetector(int failures = 5, double slowFactor = 3.0, qint64 ejectionMs = 1000,
+                    qint64 maxEjectionMs = 30000, double maxEjected = 0.5);
+
+    // answered records a response from address after ms
+    void answered(const QString& service, const QString& address, double ms, qint64 now);
+    // timedOut records a request to address that was not answered
+    void timedOut(const QString& service, const QString& address, qint64 now);
+    // abandoned records a request whose outcome is unknown, e.g. one another
+    // instance answered first after waitedMs, which the response time is taken
+    // to be at least; a negative wait is not counted. It frees the probe slot.
+    void abandoned(const QString& service, const QString& address, double waitedMs, qint64 now);
+
+    // isEjected returns whether requests for service should avoid address now:
+    // it is ejected, or its ejection is over and a probe is in flight
+    bool isEjected(const QString& service, const QString& address, qint64 now) const;
+    // sent records a request to address; the first after an ejection is its probe
+    void sent(const QString& service, const QString& address, qint64 now);
+
+    // prune forgets the instances sent nothing for idleMs, other than those
+    // still ejected
+    void prune(qint64 now, qint64 idleMs);
+    // unhealthy counts the instances ejected or on probation
+    int unhealthy() const { return mUnhealthy; }
+    qint64 ejections() const { return mEjections; }
+
+private:
+    enum State { Closed, Open, HalfOpen };
+    struct Instance {
+        State state = Closed;
+        int failures = 0; // timeouts in a row
+        int ejections = 0; // ejections in a row, which set the back-off
+        double latency = 0; // moving average of response times in ms
+        int samples = 0;
+        qint64 until = 0; // end of the ejection, or of the probe's lease
+        bool probing = false;
+        qint64 active = 0; // last request or outcome
+    };
+
+    int mFailures;
+    double mSlowFactor;
+    qint64 mEjectionMs;
+    qint64 mMaxEjectionMs;
+    double mMaxEjected;
+    QHash<QString, QHash<QString, Instance>> mServices; // service -> address -> instance
+    int mUnhealthy = 0;
+    qint64 mEjections = 0;
+
+    void sample(QHash<QString, Instance>& instances, Instance& instance, double ms, qint64 now);
+    void eject(const QHash<QString, Instance>& instances, Instance& instance, qint64 now);
+    void setState(Instance& instance, State state);
+    bool isSlow(const QHash<QString, Instance>& instances, const Instance& instance) const;
+};
+
+#endif // OUTLIERDETECTOR_H
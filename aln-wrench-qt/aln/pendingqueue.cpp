@@ -0,0 +1,73 @@
+#include "pendingqueue.h"
+#include "packet.h"
+
+PendingQueue::PendingQueue(qint64 ttlMs, int perAddress, qint64 memoryLimit)
+    : mTtl(ttlMs), mPerAddress(perAddress), mMemoryLimit(memoryLimit), mCount(0), mBytes(0) {}
+
+PendingQueue::~PendingQueue() {
+    clear();
+}
+
+bool PendingQueue::enqueue(const QString& address, Packet* packet, qint64 now) {
+    qint64 bytes = footprint(packet);
+    auto it = mQueues.find(address);
+    if ((it != mQueues.end() && it.value().size() >= mPerAddress) || mBytes + bytes > mMemoryLimit) {
+        delete packet;
+        return false;
+    }
+    if (it == mQueues.end())
+        it = mQueues.insert(address, QQueue<Entry>());
+    it.value().enqueue(Entry{packet, now, bytes});
+    mCount++;
+    mBytes += bytes;
+    return true;
+}
+
+QList<Packet*> PendingQueue::take(const QString& address) {
+    QList<Packet*> packets;
+    auto it = mQueues.find(address);
+    if (it == mQueues.end())
+        return packets;
+    for (const Entry& e : it.value()) {
+        packets.append(e.packet);
+        mBytes -= e.bytes;
+    }
+    mCount -= packets.size();
+    mQueues.erase(it);
+    return packets;
+}
+
+int PendingQueue::expire(qint64 now) {
+    int expired = 0;
+    for (auto it = mQueues.begin(); it != mQueues.end();) {
+        QQueue<Entry>& queue = it.value();
+        while (!queue.isEmpty() && now - queue.head().queued >= mTtl) {
+            Entry e = queue.dequeue();
+            mBytes -= e.bytes;
+            delete e.packet;
+            expired++;
+        }
+        if (queue.isEmpty())
+            it = mQueues.erase(it);
+        else
+            ++it;
+    }
+    mCount -= expired;
+    return expired;
+}
+
+void PendingQueue::clear() {
+    for (const QQueue<Entry>& queue : mQueues) {
+        for (const Entry& e : queue)
+            delete e.packet;
+    }
+    mQueues.clear();
+    mCount = 0;
+    mBytes = 0;
+}
+
+// footprint estimates the memory held by a queued packet
+qint64 PendingQueue::footprint(const Packet* packet) {
+    return sizeof(Packet) + sizeof(Entry) + packet->data.size()
+        + 2 * (packet->srv.size() + packet->srcAddress.size() + packet->destAddress.size() + packet->nxtAddress.size());
+}
@@ -0,0 +1,56 @@
+#ifndef PENDINGQUEUE_H
+#define PENDINGQUEUE_H
+
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QString>
+#include <QtGlobal>
+
+class Packet;
+
+// PendingQueue holds packets for destinations that have no route yet, until a
+// route is installed or the packets expire. Each destination's packets are
+// kept in arrival order and bounded in number, and all packets together are
+// bounded in bytes; a packet that would exceed either bound is refused. The
+// queue owns the packets it holds.
+class PendingQueue {
+public:
+    explicit PendingQueue(qint64 ttlMs = 3000, int perAddress = 64, qint64 memoryLimit = 1 << 20);
+    ~PendingQueue();
+
+    // enqueue takes ownership of packet and returns whether it was queued
+    bool enqueue(const QString& address, Packet* packet, qint64 now);
+    // take removes and returns the packets for address, oldest first
+    QList<Packet*> take(const QString& address);
+    // expire deletes the packets queued longer than the ttl and returns how many
+    int expire(qint64 now);
+    void clear();
+
+    void setTtl(qint64 ttlMs) { mTtl = ttlMs; }
+    qint64 ttl() const { return mTtl; }
+    bool contains(const QString& address) const { return mQueues.contains(address); }
+    bool isEmpty() const { return mQueues.isEmpty(); }
+    int size() const { return mCount; }
+    qint64 memoryUsage() const { return mBytes; }
+
+private:
+    Q_DISABLE_COPY(PendingQueue)
+
+    struct Entry {
+        Packet* packet;
+        qint64 queued;
+        qint64 bytes;
+    };
+
+    qint64 mTtl;
+    int mPerAddress;
+    qint64 mMemoryLimit;
+    QHash<QString, QQueue<Entry>> mQueues;
+    int mCount;
+    qint64 mBytes;
+
+    static qint64 footprint(const Packet* packet);
+};
+
+#endif // PENDINGQUEUE_H
@@ -0,0 +1,83 @@
+#include "responsecache.h"
+
+// the bytes an entry holds beyond its strings and data
+#define RESPONSECACHE_ENTRY_OVERHEAD 96
+
+ResponseCache::ResponseCache(qint64 memoryLimit)
+    : mMemoryLimit(memoryLimit) {}
+
+bool ResponseCache::find(const QString& service, const QByteArray& request, qint64 now,
+                         QString* responder, QByteArray* response) {
+    auto it = mEntries.find(qMakePair(service, request));
+    if (it != mEntries.end() && it.value().expires <= now) {
+        erase(it);
+        mStats.expired++;
+        it = mEntries.end();
+    }
+    if (it == mEntries.end()) {
+        mStats.misses++;
+        return false;
+    }
+    Entry& entry = it.value();
+    mByUse.remove(entry.used);
+    entry.used = ++mUses;
+    mByUse.insert(entry.used, it.key());
+    *responder = entry.responder;
+    *response = entry.response;
+    mStats.hits++;
+    return true;
+}
+
+void ResponseCache::insert(const QString& service, const QByteArray& request, const QString& responder,
+                           const QByteArray& response, qint64 ttlMs, qint64 now) {
+    Key key(service, request);
+    auto it = mEntries.find(key);
+    if (it != mEntries.end())
+        erase(it);
+    qint64 bytes = RESPONSECACHE_ENTRY_OVERHEAD + 2 * (service.size() + responder.size())
+        + request.size() + response.size();
+    if (bytes > mMemoryLimit)
+        return;
+    shrink(mMemoryLimit - bytes);
+    Entry entry{responder, response, now + ttlMs, ++mUses, bytes};
+    mEntries.insert(key, entry);
+    mByUse.insert(entry.used, key);
+    mStats.entries++;
+    mStats.bytes += bytes;
+}
+
+void ResponseCache::remove(const QString& service) {
+    for (auto it = mEntries.begin(); it != mEntries.end();) {
+        if (it.key().first == service)
+            it = erase(it);
+        else
+            ++it;
+    }
+}
+
+void ResponseCache::clear() {
+    mEntries.clear();
+    mByUse.clear();
+    mStats.entries = 0;
+    mStats.bytes = 0;
+}
+
+void ResponseCache::setMemoryLimit(qint64 bytes) {
+    mMemoryLimit = bytes;
+    shrink(bytes);
+}
+
+QHash<ResponseCache::Key, ResponseCache::Entry>::iterator ResponseCache::erase(QHash<Key, Entry>::iterator it) {
+    mByUse.remove(it.value().used);
+    mStats.entries--;
+    mStats.bytes -= it.value().bytes;
+    return mEntries.erase(it);
+}
+
+// shrink evicts the least recently used responses until at most limit bytes are held
+void ResponseCache::shrink(qint64 limit) {
+    while (mStats.bytes > limit && !mByUse.isEmpty()) {
+        erase(mEntries.find(mByUse.first()));
+        mStats.evicted++;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QtGlobal>
+
+// ResponseCache holds the responses of idempotent services by (service,
+// request data), so a repeated request can be answered without a round trip.
+// Each response expires after its ttl. All responses together are bounded in
+// bytes, and the least recently used ones are evicted to make room.
+class ResponseCache {
+public:
+    class Stats {
+    public:
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 evicted = 0; // to stay within the memory limit
+        qint64 expired = 0;
+        int entries = 0;
+        qint64 bytes = 0;
+        double hitRate() const { return hits + misses > 0 ? (double)hits / (hits + misses) : 0; }
+    };
+
+    explicit ResponseCache(qint64 memoryLimit = 1 << 20);
+
+    // find returns whether an unexpired response to request is held, and its
+    // responder and data
+    bool find(const QString& service, const QByteArray& request, qint64 now,
+              QString* responder, QByteArray* response);
+    // insert holds response until now + ttlMs; a response larger than the
+    // memory limit is not held
+    void insert(const QString& service, const QByteArray& request, const QString& responder,
+                const QByteArray& response, qint64 ttlMs, qint64 now);
+    // remove drops the responses of service
+    void remove(const QString& service);
+    void clear();
+
+    void setMemoryLimit(qint64 bytes);
+    const Stats& stats() const { return mStats; }
+
+private:
+    typedef QPair<QString, QByteArray> Key;
+    struct Entry {
+        QString responder;
+        QByteArray response;
+        qint64 expires;
+        qint64 used; // key in mByUse
+        qint64 bytes;
+    };
+
+    qint64 mMemoryLimit;
+    QHash<Key, Entry> mEntries;
+    QMap<qint64, Key> mByUse; // least recently used first
+    qint64 mUses = 0;
+    Stats mStats;
+
+    QHash<Key, Entry>::iterator erase(QHash<Key, Entry>::iterator it);
+    void shrink(qint64 limit);
+};
+
+#endif // RESPONSECACHE_H
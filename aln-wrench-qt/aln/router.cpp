@@ -1,37 +1,305 @@
 #include "router.h"
+#include <QPointer>
 #include <QRandomGenerator>
+#include <QThread>
+#include <QtMath>
 
-Router::Router(QString address) {
+// nextSeq returns the next even sequence number after seq; zero is skipped as
+// it marks unsequenced advertisements
+static INT16U nextSeq(INT16U seq) {
+    INT16U next = (seq & ~1) + 2;
+    return next == 0 ? 2 : next;
+}
+
+// equalHopIndex returns the position of channel among the entry's equal-cost
+// next hops, or -1
+static int equalHopIndex(const RouteEntry& entry, Channel* channel) {
+    for (int i = 0; i < entry.equalHops.size(); i++) {
+        if (entry.equalHops.at(i).channel == channel)
+            return i;
+    }
+    return -1;
+}
+
+// routesThrough returns whether traffic to the entry's address leaves on channel,
+// through its next hop or one of its equal-cost next hops
+static bool routesThrough(const RouteEntry& entry, Channel* channel) {
+    return entry.channel == channel || equalHopIndex(entry, channel) >= 0;
+}
+
+// offerAlternate records the route advertised by a neighbor other than the next
+// hop as the entry's alternate if it is loop-free: the neighbor's distance
+// (cost - 1) must be shorter than its distance through this node (1 + entry.cost),
+// and its information no older than the entry's
+static void offerAlternate(RouteEntry& entry, const QString& nextHop, Channel* channel, short cost, INT16U seq) {
+    if (channel == entry.channel || equalHopIndex(entry, channel) >= 0)
+        return;
+    bool loopFree = cost <= entry.cost + 1 && (seq == 0 || entry.seq == 0 || !seqNewer(entry.seq, seq));
+    if (!loopFree) {
+        if (entry.altChannel == channel)
+            entry.altChannel = nullptr;
+        return;
+    }
+    if (entry.altChannel == nullptr || entry.altChannel == channel || cost < entry.altCost) {
+        entry.altNextHop = nextHop;
+        entry.altChannel = channel;
+        entry.altCost = cost;
+        entry.altSeq = seq;
+    }
+}
+
+// promoteAlternate makes the entry's alternate its next hop
+static void promoteAlternate(RouteEntry& entry) {
+    entry.nextHop = entry.altNextHop;
+    entry.channel = entry.altChannel;
+    entry.cost = entry.altCost;
+    entry.seq = entry.altSeq;
+    entry.altChannel = nullptr;
+}
+
+// offerEqualHop records a neighbor other than the next hop that advertises the
+// entry's cost as a further next hop, and returns whether it was added. Being a
+// hop nearer the destination, the neighbor cannot route to it through this node.
+static bool offerEqualHop(RouteEntry& entry, const QString& nextHop, Channel* channel, INT16U seq) {
+    if (channel == entry.channel)
+        return false;
+    int i = equalHopIndex(entry, channel);
+    if (i >= 0) {
+        entry.equalHops[i].seq = seq;
+        return false;
+    }
+    if (entry.equalHops.size() + 1 >= ROUTER_MAX_PATHS)
+        return false;
+    if (entry.altChannel == channel)
+        entry.altChannel = nullptr;
+    RouteHop hop;
+    hop.nextHop = nextHop;
+    hop.channel = channel;
+    hop.seq = seq;
+    entry.equalHops.append(hop);
+    return true;
+}
+
+// promoteEqualHop makes the entry's first equal-cost next hop its next hop at
+// the same cost
+static void promoteEqualHop(RouteEntry& entry) {
+    RouteHop hop = entry.equalHops.takeFirst();
+    entry.nextHop = hop.nextHop;
+    entry.channel = hop.channel;
+    if (hop.seq != 0 && (entry.seq == 0 || seqNewer(hop.seq, entry.seq)))
+        entry.seq = hop.seq;
+}
+
+// dropEqualHops offers the entry's equal-cost next hops, which advertised cost,
+// as its alternate once the entry's own cost has changed
+static void dropEqualHops(RouteEntry& entry, short cost) {
+    QVector<RouteHop> hops;
+    hops.swap(entry.equalHops);
+    for (const RouteHop& hop : hops)
+        offerAlternate(entry, hop.nextHop, hop.channel, cost, hop.seq);
+}
+
+Router::Router(QString address)
+    : mStateStale(true), mExpiryWheel(ROUTER_EXPIRY_TICK_MS), mResponseCache(ROUTER_CACHE_MEMORY),
+      mOutliers(ROUTER_OUTLIER_FAILURES, ROUTER_OUTLIER_SLOW_FACTOR, ROUTER_OUTLIER_EJECTION_MS,
+                ROUTER_OUTLIER_MAX_EJECTION_MS, ROUTER_OUTLIER_MAX_EJECTED),
+      mUnhealthy(0), mFloodFilter(ROUTER_FLOOD_WINDOW_MS),
+      mPending(ROUTER_PENDING_TTL_MS, ROUTER_PENDING_PER_ADDRESS, ROUTER_PENDING_MEMORY),
+      mQueryFilter(ROUTER_MIN_SHARE_INTERVAL_MS) {
     if (address.length() > 0) {
         mAddress = address;
     }
+    mFlowSeed = qHash(mAddress);
+    mClock.start();
+    mExpiryTimer.setInterval(ROUTER_TIMER_INTERVAL_MS);
+    connect(&mExpiryTimer, SIGNAL(timeout()), this, SLOT(onExpiryTick()));
+    if (mRouteExpiry > 0 || mServiceExpiry > 0)
+        mExpiryTimer.start();
+    mUpdateTimer.setSingleShot(true);
+    mUpdateTimer.setInterval(mUpdateWindow);
+    connect(&mUpdateTimer, SIGNAL(timeout()), this, SLOT(flushUpdates()));
+    mRefreshTimer.setSingleShot(true);
+    connect(&mRefreshTimer, SIGNAL(timeout()), this, SLOT(onRefreshTimer()));
+    mLoadTimer.setInterval(ROUTER_LOAD_SAMPLE_MS);
+    connect(&mLoadTimer, SIGNAL(timeout()), this, SLOT(onLoadTimer()));
+    mLoadTimer.start();
+    mHedgeTimer.setSingleShot(true);
+    connect(&mHedgeTimer, SIGNAL(timeout()), this, SLOT(onHedgeTimer()));
+    scheduleRefresh();
+    publishState();
+}
+
+Router::~Router() {
+    QList<std::shared_ptr<ServiceExecutor>> executors;
+    {
+        QMutexLocker lock(&mMutex);
+        executors = serviceExecutors.values();
+        serviceExecutors.clear();
+    }
+    foreach (std::shared_ptr<ServiceExecutor> executor, executors)
+        executor->shutdown();
+    mServicePool.waitForDone();
+}
+
+// invalidateState marks the published forwarding state out of date; callers hold mMutex.
+// The rebuild runs once the current batch of events has been handled, or sooner
+// if a sender needs the state first.
+void Router::invalidateState() {
+    if (!mStateStale.exchange(true)) {
+        QMetaObject::invokeMethod(this, "publishState", Qt::QueuedConnection);
+    }
+}
+
+void Router::publishState() {
+    QMutexLocker lock(&mMutex);
+    if (!mStateStale.load())
+        return;
+    std::shared_ptr<ForwardingState> state = std::make_shared<ForwardingState>();
+    state->localServices = serviceExecutors;
+    state->routes = routeTable;
+    foreach (QString service, serviceTable.services()) {
+        state->services.insert(service, serviceTable.addresses(service));
+        state->serviceLoads.insert(service, serviceTable.loads(service));
+        if (mBalance.value(service) == ServiceBalancer::Affinity) {
+            state->rings.insert(service, HashRing(state->services.value(service), state->serviceLoads.value(service),
+                                                  ROUTER_AFFINITY_REPLICAS, ROUTER_AFFINITY_BALANCE));
+        }
+    }
+    state->balance = mBalance;
+    std::shared_ptr<const ForwardingState> replaced = std::atomic_exchange(&mState, std::shared_ptr<const ForwardingState>(state));
+    mStateStale.store(false);
+    pruneRetiredStates();
+    if (replaced)
+        mRetired.append(replaced);
+}
+
+// pruneRetiredStates forgets the replaced forwarding states no sender holds any
+// more and returns whether some are still held; callers hold mMutex
+bool Router::pruneRetiredStates() {
+    for (int i = mRetired.size() - 1; i >= 0; i--) {
+        if (mRetired.at(i).expired())
+            mRetired.removeAt(i);
+    }
+    return !mRetired.isEmpty();
+}
+
+// waitForSenders returns once every sender has let go of the forwarding states
+// replaced so far, so that nothing still reaches a channel they route through
+void Router::waitForSenders() {
+    for (;;) {
+        {
+            QMutexLocker lock(&mMutex);
+            if (!pruneRetiredStates())
+                return;
+        }
+        QThread::yieldCurrentThread();
+    }
+}
+
+std::shared_ptr<const ForwardingState> Router::forwardingState() {
+    if (mStateStale.load())
+        publishState();
+    return std::atomic_load(&mState);
 }
 
 QStringList Router::selectServiceAddresses(QString service) {
+    std::shared_ptr<const ForwardingState> state = forwardingState();
     QStringList remoteAddresses;
-    if (serviceHandlerMap.contains(service)) {
+    if (state->localServices.contains(service)) {
         remoteAddresses.append(mAddress);
     }
-    if (serviceCapacityMap.contains(service)) {
-        QMap<QString, NodeCapacity*> addressToCapacityMap = serviceCapacityMap[service];
-        foreach (QString address, addressToCapacityMap.keys()) {
-            remoteAddresses.append(address);
+    remoteAddresses.append(state->services.value(service));
+    return remoteAddresses;
+}
+
+QString Router::selectServiceAddress(QString service, QByteArray key) {
+    std::shared_ptr<const ForwardingState> state = forwardingState();
+    if (state->localServices.contains(service)) {
+        return mAddress;
+    }
+    bool affinity = !key.isEmpty() && state->rings.contains(service);
+    QStringList addresses = state->services.value(service);
+    QVector<short> loads = state->serviceLoads.value(service);
+    ServiceBalancer::Policy policy = state->balance.value(service, ServiceBalancer::LeastLoaded);
+    bool byLoad = policy == ServiceBalancer::LeastLoaded || policy == ServiceBalancer::Affinity;
+    if (mUnhealthy.load() == 0) {
+        if (affinity)
+            return state->rings.value(service).host(key);
+        if (byLoad || addresses.size() < 2)
+            return addresses.value(0);
+    }
+
+    QMutexLocker lock(&mMutex);
+    qint64 now = mClock.elapsed();
+    // pass over ejected instances, unless all of them are
+    QSet<QString> ejected;
+    QStringList healthy;
+    QVector<short> healthyLoads;
+    for (int i = 0; i < addresses.size(); i++) {
+        if (mOutliers.isEjected(service, addresses.at(i), now)) {
+            ejected.insert(addresses.at(i));
+        } else {
+            healthy.append(addresses.at(i));
+            healthyLoads.append(loads.value(i));
         }
     }
-    return remoteAddresses;
+    if (!healthy.isEmpty()) {
+        addresses = healthy;
+        loads = healthyLoads;
+    }
+    QString dest;
+    if (affinity) {
+        dest = state->rings.value(service).host(key, ejected);
+    } else if (byLoad || addresses.size() < 2) {
+        dest = addresses.value(0);
+    } else {
+        QVector<int> outstanding;
+        if (policy != ServiceBalancer::WeightedRandom) {
+            foreach (QString address, addresses)
+                outstanding.append(mOutstanding.value(address));
+        }
+        dest = addresses.value(ServiceBalancer::choose(policy, loads, outstanding));
+    }
+    mOutliers.sent(service, dest, now);
+    return dest;
 }
 
+void Router::setOutlierDetection(bool enabled) {
+    QMutexLocker lock(&mMutex);
+    mOutlierDetection = enabled;
+    if (!enabled) {
+        mOutliers = OutlierDetector(ROUTER_OUTLIER_FAILURES, ROUTER_OUTLIER_SLOW_FACTOR, ROUTER_OUTLIER_EJECTION_MS,
+                                    ROUTER_OUTLIER_MAX_EJECTION_MS, ROUTER_OUTLIER_MAX_EJECTED);
+        mUnhealthy.store(0);
+    }
+}
 
-QString Router::send(Packet* p) {
+void Router::setBalancePolicy(QString service, ServiceBalancer::Policy policy) {
+    QMutexLocker lock(&mMutex);
+    if (policy == ServiceBalancer::LeastLoaded)
+        mBalance.remove(service);
+    else
+        mBalance.insert(service, policy);
+    invalidateState();
+}
+
+
+QString Router::send(Packet* p, QByteArray key) {
     if (p->srcAddress.length() == 0) {
         p->srcAddress = mAddress;
     }
-    if (p->destAddress.length() == 0 && p->srv.length() > 0) {
+    std::shared_ptr<const ForwardingState> state = forwardingState();
+    if (p->destAddress.length() == 0 && state->rings.contains(p->srv) && !state->localServices.contains(p->srv)) {
+        // pin the key to one instance of the service
+        if (key.isEmpty()) {
+            key = p->srcAddress.toUtf8();
+            key.append((char)(p->ctx >> 8));
+            key.append((char)(p->ctx & 0xFF));
+        }
+        p->destAddress = mUnhealthy.load() > 0 ? selectServiceAddress(p->srv, key) : state->rings.value(p->srv).host(key);
+    } else if (p->destAddress.length() == 0 && p->srv.length() > 0) {
         // send packet to any/all instances of the service
-        QMutexLocker lock = QMutexLocker(&mMutex);
         QStringList addresses = selectServiceAddresses(p->srv);
-        lock.unlock();
-
         if (addresses.length() > 0) {
             for (int i = 1; i < addresses.length(); i++) {
                 Packet* pc = p->copy();
@@ -44,61 +312,407 @@ QString Router::send(Packet* p) {
 
     if (p->destAddress == mAddress) {
         PacketHandler* handler;
-        QMutexLocker lock = QMutexLocker(&mMutex);
-        if (serviceHandlerMap.contains(p->srv)) {
-            handler = serviceHandlerMap[p->srv];
-        } else if (contextHandlerMap.contains(p->ctx)) {
-            handler = contextHandlerMap[p->ctx];
+        if (state->localServices.contains(p->srv)) {
+            // the service's executor runs the handler, off this thread
+            return state->localServices.value(p->srv)->post(p);
         } else {
-            return QString("service '%1' not registered\n").arg(p->srv);
+            QMutexLocker lock(&mMutex);
+            if (!contextTable.contains(p->ctx)) {
+                // unknown service, or a late response to a released or expired context
+                QString err = QString("service '%1' not registered\n").arg(p->srv);
+                delete p;
+                return err;
+            }
+            handler = contextTable.handler(p->ctx);
+            pinHandler(p->ctx, handler);
         }
         if (handler)
             handler->onPacket(p);
-        lock.unlock();
+        unpinHandler(handler);
         delete p;
     } else if (p->nxtAddress.length() == 0 || p->nxtAddress == mAddress) {
-        if (remoteNodeMap.contains(p->destAddress)) {
-            RemoteNodeInfo* rni = remoteNodeMap[p->destAddress];
-            p->nxtAddress = rni->nextHop;
-            rni->channel->send(p);
+        RouteTable::Handle route = state->routes.find(p->destAddress);
+        if (route != RouteTable::NoRoute && state->routes.at(route).channel) {
+            const RouteEntry& entry = state->routes.at(route);
+            int path = 0;
+            if (!entry.equalHops.isEmpty()) {
+                // a flow stays on one of the equal-cost paths so its packets keep
+                // their order; the seed keeps routers in series from all choosing
+                // the same position in their lists
+                uint flow = qHash(p->srcAddress, mFlowSeed);
+                flow = qHash(p->destAddress, flow);
+                flow = qHash(p->ctx, flow);
+                path = flow % (entry.equalHops.size() + 1);
+            }
+            if (path == 0) {
+                p->nxtAddress = entry.nextHop;
+                entry.channel->send(p);
+            } else {
+                const RouteHop& hop = entry.equalHops.at(path - 1);
+                p->nxtAddress = hop.nextHop;
+                hop.channel->send(p);
+            }
+            return QString();
         }
-        // TODO detect and broadcast route failure
-        return "send failed; no route to " + p->destAddress;
+        if (p->destAddress.length() > 0)
+            return queuePending(p);
+        QString err = "send failed; no route to " + p->destAddress;
+        delete p;
+        return err;
     } else {
+        delete p;
         return "packet is unroutable; no action taken";
     }
     return QString();
 }
 
-short Router::registerContextHandler(PacketHandler* handler) {
+// queuePending holds a packet whose destination has no route and queries the
+// neighbors for the route when it is the first packet held for the destination
+QString Router::queuePending(Packet* p) {
+    QString address = p->destAddress;
+    QMutexLocker lock(&mMutex);
+    RouteTable::Handle route = routeTable.find(address);
+    if (route != RouteTable::NoRoute && routeTable.at(route).channel) {
+        lock.unlock();
+        return send(p); // installed since the forwarding state was read
+    }
+    if (mPending.ttl() == 0) {
+        delete p;
+        return "send failed; no route to " + address;
+    }
+    qint64 now = mClock.elapsed();
+    bool query = !mPending.contains(address);
+    if (!mPending.enqueue(address, p, now))
+        return "send failed; no route to " + address + " and its pending queue is full";
+    updateTimer();
+    QVector<Channel*> targets;
+    if (query) {
+        targets = channels;
+        Packet* q = composeNetQuery(address);
+        mQueryFilter.seen(FloodFilter::fingerprint(q), now); // relayed copies are not relayed back
+        delete q;
+    }
+    lock.unlock();
+    for (Channel* ch : targets)
+        ch->send(composeNetQuery(address));
+    return QString();
+}
+
+INT16U Router::registerContextHandler(PacketHandler* handler, int timeoutMs) {
     QMutexLocker lock(&mMutex);
-    short newCtx = QRandomGenerator::global()->generate() % ((1 << 16)-1);
-    while (contextHandlerMap.contains(newCtx))
-        newCtx = QRandomGenerator::global()->generate() % ((1 << 16)-1);
-    contextHandlerMap.insert(newCtx, handler);
-    return newCtx;
+    qint64 now = mClock.elapsed();
+    INT16U ctx = contextTable.acquire(handler, timeoutMs > 0 ? now + timeoutMs : 0, now);
+    if (ctx == 0) {
+        qWarning() << "router: context table exhausted";
+    } else if (timeoutMs > 0) {
+        updateTimer();
+    }
+    return ctx;
 }
 
-void Router::releaseContext(short ctx) {
+void Router::releaseContext(INT16U ctx) {
     QMutexLocker lock(&mMutex);
-    contextHandlerMap.remove(ctx);
+    PacketHandler* handler = contextTable.contains(ctx) ? contextTable.handler(ctx) : nullptr;
+    contextTable.release(ctx, mClock.elapsed());
+    Qt::HANDLE self = QThread::currentThreadId();
+    for (;;) {
+        bool running = false;
+        for (const HandlerCall& call : mHandlerCalls) {
+            if ((call.ctx == ctx || (handler && call.handler == handler)) && call.thread != self)
+                running = true;
+        }
+        if (!running)
+            return;
+        mHandlerIdle.wait(&mMutex);
+    }
+}
+
+// pinHandler records a call of handler about to run without the lock, for
+// releaseContext to wait on; callers hold mMutex
+void Router::pinHandler(INT16U ctx, PacketHandler* handler) {
+    mHandlerCalls.append(HandlerCall{ctx, handler, QThread::currentThreadId()});
+}
+
+// unpinHandler ends the call pinHandler recorded on this thread
+void Router::unpinHandler(PacketHandler* handler) {
+    QMutexLocker lock(&mMutex);
+    Qt::HANDLE self = QThread::currentThreadId();
+    for (int i = mHandlerCalls.size() - 1; i >= 0; i--) {
+        if (mHandlerCalls.at(i).handler == handler && mHandlerCalls.at(i).thread == self) {
+            mHandlerCalls.removeAt(i);
+            break;
+        }
+    }
+    mHandlerIdle.wakeAll();
+}
+
+// RequestHandler adapts the callbacks of Router::request to a context handler
+// and deletes itself once the exchange is over
+class RequestHandler : public PacketHandler {
+    Router* router;
+    ResponseCallback onResponse;
+    TimeoutCallback onTimeoutCallback;
+    std::atomic<bool> finished;
+    QPointer<QObject> receiver; // the callbacks are not called once it is destroyed
+    bool guarded = false;
+public:
+    INT16U ctx = 0;
+    QString service;
+    QByteArray data;
+    // guarded by the router's mutex
+    QStringList dests; // instances asked, the first and any hedge
+    QString responder; // the instance whose responses are delivered
+    int responses = 0; // delivered so far
+    QVector<double> sent; // when each of dests was asked, in ms on the router's clock
+
+    RequestHandler(Router* r, QString s, QByteArray d, ResponseCallback response, TimeoutCallback timeout)
+        : router(r), onResponse(response), onTimeoutCallback(timeout), finished(false), service(s), data(d) {}
+
+    void guard(QObject* r) {
+        receiver = r;
+        guarded = true;
+    }
+
+    void onPacket(Packet* p) {
+        if (finished.load() || (guarded && !receiver) || !router->acceptResponse(this, p))
+            return;
+        if (!onResponse(p) && !finished.exchange(true)) {
+            router->releaseContext(ctx);
+            router->finishRequest(this, p);
+            deleteLater();
+        }
+    }
+
+    void onTimeout(INT16U) {
+        if (finished.exchange(true))
+            return;
+        router->finishRequest(this, nullptr, true);
+        if (onTimeoutCallback && !(guarded && !receiver))
+            onTimeoutCallback();
+        deleteLater();
+    }
+
+    // cancel ends the request without calling back, as when its receiver is destroyed
+    void cancel() {
+        if (finished.exchange(true))
+            return;
+        router->releaseContext(ctx);
+        router->finishRequest(this);
+        deleteLater();
+    }
+};
+
+QString Router::request(QString dest, QString service, QByteArray data, int timeoutMs,
+                        ResponseCallback onResponse, TimeoutCallback onTimeout) {
+    return request(dest, service, data, timeoutMs, nullptr, onResponse, onTimeout);
+}
+
+QString Router::request(QString dest, QString service, QByteArray data, int timeoutMs, QObject* receiver,
+                        ResponseCallback onResponse, TimeoutCallback onTimeout) {
+    if (timeoutMs <= 0)
+        return "request failed; the timeout must be positive";
+    QString responder;
+    QByteArray response;
+    bool cached = false;
+    {
+        QMutexLocker lock(&mMutex);
+        cached = mCacheTtl.contains(service)
+            && mResponseCache.find(service, data, mClock.elapsed(), &responder, &response);
+    }
+    if (cached) {
+        Packet answer(mAddress, response);
+        answer.srcAddress = responder;
+        onResponse(&answer);
+        return QString();
+    }
+    bool chosen = dest.isEmpty();
+    if (chosen) {
+        dest = selectServiceAddress(service);
+        if (dest.isEmpty())
+            return QString("request failed; service '%1' not found").arg(service);
+    }
+    RequestHandler* handler = new RequestHandler(this, service, data, onResponse, onTimeout);
+    handler->ctx = registerContextHandler(handler, timeoutMs);
+    if (handler->ctx == 0) {
+        delete handler;
+        return "request failed; no free context";
+    }
+    INT16U ctx = handler->ctx;
+    if (receiver) {
+        handler->guard(receiver);
+        connect(receiver, &QObject::destroyed, handler, [handler]() { handler->cancel(); });
+    }
+    {
+        QMutexLocker lock(&mMutex);
+        handler->dests.append(dest);
+        handler->sent.append(mClock.nsecsElapsed() / 1e6);
+        mOutstanding[dest]++;
+        auto hedging = mHedging.find(service);
+        if (chosen && dest != mAddress && hedging != mHedging.end()) {
+            hedging->budget = qMin(hedging->budget + hedging->rate, (double)ROUTER_HEDGE_BURST);
+            double delay = hedging->latency.percentile(hedging->percentile, ROUTER_HEDGE_MIN_SAMPLES);
+            if (delay >= 0) {
+                qint64 wait = qMax(qCeil(delay), 1);
+                qint64 deadline = mClock.elapsed() + wait;
+                if (mHedges.isEmpty() || deadline < mHedges.firstKey()) {
+                    // the timer belongs to the router's thread
+                    QMetaObject::invokeMethod(&mHedgeTimer, "start", Qt::QueuedConnection, Q_ARG(int, (int)wait));
+                }
+                mHedges.insert(deadline, qMakePair(ctx, handler));
+            }
+        }
+    }
+    QString err = send(new Packet(dest, service, ctx, data));
+    if (err.length() > 0) {
+        QMutexLocker lock(&mMutex);
+        if (contextTable.handler(ctx) == handler) {
+            contextTable.release(ctx, mClock.elapsed());
+            lock.unlock();
+            finishRequest(handler);
+            delete handler;
+        }
+    }
+    return err;
+}
+
+// acceptResponse returns whether p answers the request; the first instance to
+// respond answers it, and its response time is sampled when the service is hedged
+bool Router::acceptResponse(RequestHandler* request, Packet* p) {
+    QMutexLocker lock(&mMutex);
+    int asked = request->dests.indexOf(p->srcAddress);
+    if (request->responder.isEmpty() && asked >= 0) {
+        request->responder = p->srcAddress;
+        double now = mClock.nsecsElapsed() / 1e6;
+        // hedges wait on the time the request has waited, and outliers are
+        // judged on the responder's own response time
+        auto hedging = mHedging.find(request->service);
+        if (hedging != mHedging.end())
+            hedging->latency.add(now - request->sent.first());
+        if (mOutlierDetection && p->srcAddress != mAddress) {
+            mOutliers.answered(request->service, p->srcAddress, now - request->sent.at(asked), mClock.elapsed());
+            mUnhealthy.store(mOutliers.unhealthy());
+        }
+    } else if (request->responder.isEmpty()) {
+        request->responder = p->srcAddress; // answered from an address it was not sent to
+    }
+    if (request->responder != p->srcAddress)
+        return false;
+    request->responses++;
+    return true;
+}
+
+void Router::finishRequest(RequestHandler* request, Packet* answer, bool timedOut) {
+    QMutexLocker lock(&mMutex);
+    qint64 now = mClock.elapsed();
+    for (int i = 0; i < request->dests.size(); i++) {
+        QString dest = request->dests.at(i);
+        auto it = mOutstanding.find(dest);
+        if (it != mOutstanding.end() && --it.value() <= 0)
+            mOutstanding.erase(it);
+        if (!mOutlierDetection || dest == mAddress || dest == request->responder)
+            continue;
+        if (timedOut) {
+            mOutliers.timedOut(request->service, dest, now);
+        } else {
+            // outrun by the responder, or never sent
+            double waited = request->responder.isEmpty() ? -1 : mClock.nsecsElapsed() / 1e6 - request->sent.at(i);
+            mOutliers.abandoned(request->service, dest, waited, now);
+        }
+    }
+    mUnhealthy.store(mOutliers.unhealthy());
+    auto ttl = mCacheTtl.constFind(request->service);
+    if (answer && request->responses == 1 && ttl != mCacheTtl.constEnd()) {
+        mResponseCache.insert(request->service, request->data, answer->srcAddress, answer->data,
+                              ttl.value(), mClock.elapsed());
+    }
+}
+
+void Router::setResponseCache(QString service, int ttlMs) {
+    QMutexLocker lock(&mMutex);
+    if (ttlMs > 0) {
+        mCacheTtl.insert(service, ttlMs);
+    } else {
+        mCacheTtl.remove(service);
+        mResponseCache.remove(service);
+    }
+}
+
+void Router::setResponseCacheMemory(qint64 bytes) {
+    QMutexLocker lock(&mMutex);
+    mResponseCache.setMemoryLimit(bytes);
+}
+
+ResponseCache::Stats Router::responseCacheStats() {
+    QMutexLocker lock(&mMutex);
+    return mResponseCache.stats();
+}
+
+void Router::setHedging(QString service, double percentile, double rate) {
+    QMutexLocker lock(&mMutex);
+    if (percentile <= 0) {
+        mHedging.remove(service);
+        return;
+    }
+    HedgePolicy& hedging = mHedging[service];
+    hedging.percentile = qMin(percentile, 1.0);
+    hedging.rate = qMax(rate, 0.0);
+}
+
+// onHedgeTimer sends a second copy of each request that is still unanswered at
+// its deadline, to the least loaded instance not yet asked, while the service
+// has hedges to spend
+void Router::onHedgeTimer() {
+    std::shared_ptr<const ForwardingState> state = forwardingState();
+    QList<Packet*> hedges;
+    {
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        while (!mHedges.isEmpty() && mHedges.firstKey() <= now) {
+            QPair<INT16U, RequestHandler*> entry = mHedges.first();
+            mHedges.erase(mHedges.begin());
+            RequestHandler* request = entry.second;
+            if (contextTable.handler(entry.first) != request || !request->responder.isEmpty())
+                continue; // answered, timed out or failed
+            auto hedging = mHedging.find(request->service);
+            if (hedging == mHedging.end() || hedging->budget < 1)
+                continue;
+            QString dest;
+            foreach (QString address, state->services.value(request->service)) {
+                if (!request->dests.contains(address) && !mOutliers.isEjected(request->service, address, now)) {
+                    dest = address;
+                    break;
+                }
+            }
+            if (dest.isEmpty())
+                continue;
+            hedging->budget -= 1;
+            mOutliers.sent(request->service, dest, now);
+            request->dests.append(dest);
+            request->sent.append(mClock.nsecsElapsed() / 1e6);
+            mOutstanding[dest]++;
+            hedges.append(new Packet(dest, request->service, entry.first, request->data));
+        }
+        if (!mHedges.isEmpty())
+            mHedgeTimer.start((int)qMax<qint64>(mHedges.firstKey() - now, 1));
+    }
+    foreach (Packet* p, hedges) {
+        QString dest = p->destAddress;
+        QString err = send(p);
+        if (err.length() > 0)
+            qDebug() << QString("router '%1' hedge to '%2' failed: %3").arg(mAddress, dest, err);
+    }
 }
 
 QMap<QString, QStringList> Router::nodeServices() {
+    std::shared_ptr<const ForwardingState> state = forwardingState();
     QMap<QString, QStringList> nodeServiceMap;
-    nodeServiceMap.insert(mAddress, serviceHandlerMap.keys());
-    foreach (QString service, serviceCapacityMap.keys()) {
-        QMap<QString, NodeCapacity*> capacityMap = serviceCapacityMap[service];
-        foreach (QString address, capacityMap.keys()) {
-            QStringList services;
-            if (nodeServiceMap.contains(address)) {
-                services = nodeServiceMap.value(address);
-            }
-            services.append(service);
-            nodeServiceMap.insert(address, services);
+    nodeServiceMap.insert(mAddress, state->localServices.keys());
+    for (auto it = state->services.constBegin(); it != state->services.constEnd(); ++it) {
+        foreach (QString address, it.value()) {
+            nodeServiceMap[address].append(it.key());
         }
     }
-    foreach (QString address, remoteNodeMap.keys()) {
+    foreach (QString address, state->routes.addresses()) {
         if (!nodeServiceMap.contains(address)) {
             nodeServiceMap.insert(address, QStringList());
         }
@@ -106,10 +720,11 @@ QMap<QString, QStringList> Router::nodeServices() {
     return nodeServiceMap;
 }
 
-Packet* Router::composeNetRouteShare(QString address, short cost) {
+Packet* Router::composeNetRouteShare(QString address, short cost, INT16U seq) {
     Packet* p = new Packet();
     p->net = Packet::NetState::ROUTE;
     p->srcAddress = mAddress;
+    p->seqNum = seq; // the origin's sequence number travels in the header
     p->data.clear();
     QBuffer buffer(&p->data);
     buffer.open(QIODevice::Append);
@@ -145,14 +760,16 @@ RemoteNodeInfo Router::parseNetRouteShare(Packet* p) {
     offset += addrSize;
     info.cost = readINT16U((INT08U*)data.mid(offset, 2).data());
     info.nextHop = p->srcAddress;
+    info.seq = p->seqNum;
 
     return info;
 }
 
-Packet* Router::composeNetServiceShare(QString address, QString service, short capacity) {
+Packet* Router::composeNetServiceShare(QString address, QString service, short capacity, INT16U seq) {
     Packet* p = new Packet();
     p->net = Packet::NetState::SERVICE;
     p->srcAddress = mAddress;
+    p->seqNum = seq; // the host's version travels in the header
     p->data.clear();
     QBuffer buffer(&p->data, this);
     buffer.open(QIODevice::Append);
@@ -176,35 +793,93 @@ ServiceNodeInfo Router::parseNetServiceShare(Packet* p) {
         return info;
     }
 
-    char* data = p->data.data();
-    char addrSize = data[0];
+    INT08U* data = (INT08U*)p->data.data();
+    INT08U addrSize = data[0];
     int offset = 1;
     info.address = p->data.mid(offset, addrSize);
     offset += addrSize;
 
-    char srvSize = data[offset];
+    if (p->data.length() < offset + 1) {
+        info.err = QString("parseNetServiceSharePacket: len: %1; exp: >%2").arg(p->data.length()).arg(offset);
+        return info;
+    }
+    INT08U srvSize = data[offset];
     offset += 1;
     info.service = p->data.mid(offset, srvSize);
     offset += srvSize;
 
-    info.capacity = readINT16U((INT08U*)data);
+    if (p->data.length() != offset + 2) {
+        info.err = QString("parseNetServiceSharePacket: len: %1; exp: %2").arg(p->data.length()).arg(offset + 2);
+        return info;
+    }
+    info.capacity = readINT16U(data + offset);
+    info.nextHop = p->srcAddress;
+    info.seq = p->seqNum;
     return info;
 }
 
-Packet* Router::composeNetQuery() {
+Packet* Router::composeNetQuery(QString address) {
     Packet* p = new Packet();
     p->net = Packet::NetState::QUERY;
+    if (address.length() > 0) {
+        // a targeted query asks for the route to one address
+        QBuffer buffer(&p->data);
+        buffer.open(QIODevice::Append);
+        writeToBuffer(&buffer, (INT08U)address.length());
+        writeToBuffer(&buffer, address);
+        buffer.close();
+    }
     return p;
 }
 
+// parseNetQuery returns the address of a targeted query, or an empty string for
+// a query of the full tables
+QString Router::parseNetQuery(Packet* p) {
+    if (p->data.length() == 0)
+        return QString();
+    INT08U addrSize = p->data[0];
+    if (p->data.length() != addrSize + 1) {
+        qDebug() << QString("parseNetQuery: len: %1; exp: %2").arg(p->data.length()).arg(addrSize + 1);
+        return QString();
+    }
+    return p->data.mid(1, addrSize);
+}
+
+// withdrawRoute removes a route lost with its next hop and queues the withdrawal;
+// callers hold mMutex. The withdrawal carries the route's number made odd, which
+// is newer than the route itself and older than the origin's next advertisement.
+void Router::withdrawRoute(RouteTable::Handle route, Channel* origin) {
+    const RouteEntry& entry = routeTable.at(route);
+    QString address = entry.address;
+    INT16U seq = 0;
+    if (entry.seq != 0) {
+        seq = entry.seq | 1;
+        mWithdrawn.insert(address, qMakePair(seq, mClock.elapsed()));
+    }
+    queueRouteUpdate(address, 0, seq, origin);
+    removeAddress(address);
+}
+
 void Router::removeAddress(QString address) {
-    remoteNodeMap.remove(address);
-    foreach(QString service, serviceCapacityMap.keys())
-        serviceCapacityMap[service].remove(address);
+    // the host's services are news again when next advertised, even at the same versions
+    foreach (QString service, serviceTable.services(address)) {
+        const NodeCapacity* capacity = serviceTable.find(service, address);
+        if (capacity->seq == 0)
+            continue;
+        Packet* share = composeNetServiceShare(address, service, capacity->capacity, capacity->seq);
+        mFloodFilter.forget(FloodFilter::fingerprint(share));
+        delete share;
+    }
+    routeTable.remove(address);
+    serviceTable.removeAddress(address);
+    invalidateState();
 }
 
 void Router::handleNetState(Channel* channel, Packet* packet) {
     bool stateChanged = false;
+    Channel* relayChannel = nullptr;
+    Packet* relay = nullptr;
+    QList<Packet*> pending; // held for a route installed here
     switch (packet->net) {
     case Packet::NetState::ROUTE: {
         qDebug() << QString("router '%1' recv'd ROUTE update").arg(mAddress);
@@ -215,110 +890,303 @@ void Router::handleNetState(Channel* channel, Packet* packet) {
             return;
         }
 
-        QString msg("NET_ROUTE [%1] to:%2, via:%3, cost:%4");
-        qDebug() << msg.arg(mAddress, info.address, packet->srcAddress).arg(info.cost);
-        if (info.cost == 0) { // zero cost routes are removed
-            if (info.address == mAddress) {
-                // TODO short delay
-                shareNetState();
-                return;
-            } else if (remoteNodeMap.contains(info.address)) {
-                // remove the route
+        QString msg("NET_ROUTE [%1] to:%2, via:%3, cost:%4, seq:%5");
+        qDebug() << msg.arg(mAddress, info.address, packet->srcAddress).arg(info.cost).arg(info.seq);
+        if (info.address == mAddress) {
+            QMutexLocker lock(&mMutex);
+            qint64 now = mClock.elapsed();
+            bool outbid = info.seq != 0 && seqNewer(info.seq, mSeq);
+            bool legacyWithdrawal = info.seq == 0 && info.cost == 0;
+            if (outbid || (legacyWithdrawal && now - mLastShare >= ROUTER_MIN_SHARE_INTERVAL_MS)) {
+                // the mesh holds a withdrawal of this node, or a number from before a
+                // restart; re-advertise under a newer number than any in circulation
+                mSeq = nextSeq(outbid ? info.seq : mSeq);
+                mLastShare = now;
+                queueRouteUpdate(mAddress, 1, mSeq, nullptr);
+                lock.unlock();
+                triggerUpdates();
+            }
+            return;
+        }
 
-                RemoteNodeInfo* localInfo = remoteNodeMap[info.address];
-                QMutexLocker lock(&mMutex);
-                removeAddress(info.address);
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        RouteTable::Handle route = routeTable.find(info.address);
+        auto withdrawn = mWithdrawn.constFind(info.address);
+        if (info.seq != 0 && withdrawn != mWithdrawn.constEnd() && !seqNewer(info.seq, withdrawn.value().first)) {
+            // stale news of a withdrawn route; the withdrawal goes back to the
+            // sender, which relays it to the origin for a number that replaces it.
+            // A neighbor that reconnected or restarted is reachable again as soon
+            // as it advertises, rather than after its next refresh.
+            if (info.cost != 0 && (INT16U)info.cost != ROUTE_COST_INFINITY) {
+                relayChannel = channel;
+                relay = composeNetRouteShare(info.address, 0, withdrawn.value().first);
+            }
+            break;
+        }
+
+        if ((INT16U)info.cost == ROUTE_COST_INFINITY) {
+            // poisoned; the sender routes to the address through this node, so a
+            // route through the sender would loop
+            if (route == RouteTable::NoRoute)
+                break;
+            RouteEntry& entry = routeTable.at(route);
+            int hop = equalHopIndex(entry, channel);
+            if (entry.channel == channel && !entry.equalHops.isEmpty()) {
+                promoteEqualHop(entry);
+                invalidateState();
+                stateChanged = true;
+            } else if (entry.channel == channel) {
+                withdrawRoute(route, nullptr);
                 stateChanged = true;
-                for (Channel* ch : channels) {
-                    if (ch != localInfo->channel) {
-                        ch->send(packet);
-                    }
+            } else if (hop >= 0) {
+                entry.equalHops.remove(hop);
+                invalidateState();
+            } else if (entry.altChannel == channel) {
+                entry.altChannel = nullptr;
+            }
+            break;
+        }
+
+        if (info.cost == 0) { // zero cost routes are removed
+            if (route == RouteTable::NoRoute)
+                break;
+            RouteEntry& entry = routeTable.at(route);
+            if (entry.altChannel == channel)
+                entry.altChannel = nullptr;
+            int hop = equalHopIndex(entry, channel);
+            if (hop >= 0) {
+                entry.equalHops.remove(hop);
+                invalidateState();
+            }
+            if (info.seq != 0 && entry.seq != 0 && channel != entry.channel) {
+                // the route does not lead through the sender; pass the withdrawal on
+                // toward the origin, whose next number will outbid it
+                if (seqNewer(info.seq, entry.seq)) {
+                    relayChannel = entry.channel;
+                    relay = composeNetRouteShare(info.address, 0, info.seq);
                 }
+                break;
             }
+            if (info.seq != 0 && entry.seq != 0 && seqNewer(entry.seq, info.seq))
+                break; // older than the route it would withdraw
+            if (!entry.equalHops.isEmpty() || entry.altChannel) {
+                // the next hop lost its path; an equal-cost or alternate path does
+                // not lead through it, so traffic moves there while the withdrawal
+                // is passed on toward the origin for a fresh number that the
+                // neighbors holding it will accept
+                if (!entry.equalHops.isEmpty())
+                    promoteEqualHop(entry);
+                else
+                    promoteAlternate(entry);
+                invalidateState();
+                queueRouteUpdate(info.address, entry.cost + 1, entry.seq, entry.channel);
+                if (info.seq != 0) {
+                    relayChannel = entry.channel;
+                    relay = composeNetRouteShare(info.address, 0, info.seq);
+                }
+                stateChanged = true;
+                break;
+            }
+            if (info.seq != 0)
+                mWithdrawn.insert(info.address, qMakePair(info.seq, now));
+            queueRouteUpdate(info.address, 0, info.seq, entry.channel);
+            removeAddress(info.address);
+            stateChanged = true;
         } else { // add or update a route
-            QMutexLocker lock(&mMutex);
-            RemoteNodeInfo* localInfo;
-            if (remoteNodeMap.contains(info.address)) {
-                localInfo = remoteNodeMap[info.address];
+            mWithdrawn.remove(info.address);
+            RouteEntry& localInfo = routeTable.at(routeTable.insert(info.address));
+            bool isNew = localInfo.cost == 0;
+            if (channel == localInfo.channel && info.cost > localInfo.cost && !localInfo.equalHops.isEmpty()) {
+                // the next hop's path got longer; the other paths at the old cost are
+                // now the shortest, so traffic moves to them and nothing is advertised
+                promoteEqualHop(localInfo);
+                offerAlternate(localInfo, info.nextHop, channel, info.cost, info.seq);
+                invalidateState();
+                stateChanged = true;
+                break;
+            }
+            bool accept;
+            if (isNew) {
+                accept = true;
+            } else if (info.seq == 0 || localInfo.seq == 0 || info.seq == localInfo.seq) {
+                // unsequenced routes compare cost only; the next hop is believed
+                // when its path gets longer
+                accept = info.cost < localInfo.cost || channel == localInfo.channel;
             } else {
-                localInfo = new RemoteNodeInfo();
-                localInfo->address = info.address;
-                remoteNodeMap.insert(info.address, localInfo);
+                // fresher information wins, but a longer path only from the current
+                // next hop; newer numbers reach a node over paths of every length
+                accept = seqNewer(info.seq, localInfo.seq) && (channel == localInfo.channel || info.cost <= localInfo.cost);
             }
 
-//            localInfo.lastSeen = new Date();
-            if (info.cost < localInfo->cost || localInfo->cost == 0) {
-                stateChanged = true;
-                localInfo->channel = channel;
-                localInfo->cost = info.cost;
-                localInfo->nextHop = info.nextHop;
-                Packet* p = composeNetRouteShare(info.address, ++info.cost);
-                for (Channel* ch : channels) {
-                    if (ch != channel) {
-                        ch->send(p);
-                    }
+            if (accept) {
+                bool changed = isNew || info.cost != localInfo.cost || channel != localInfo.channel || info.seq != localInfo.seq;
+                if (isNew && mRouteExpiry > 0) {
+                    mExpiryWheel.schedule(now + mRouteExpiry, qMakePair(info.address, QString()));
+                }
+                if (isNew) {
+                    pending = mPending.take(info.address);
+                }
+                RouteEntry displaced = localInfo;
+                localInfo.channel = channel;
+                localInfo.cost = info.cost;
+                localInfo.seq = info.seq;
+                localInfo.nextHop = info.nextHop;
+                localInfo.lastSeen = now;
+                int hop = equalHopIndex(localInfo, channel);
+                if (hop >= 0) {
+                    localInfo.equalHops.remove(hop); // promoted to next hop
+                }
+                if (info.cost != displaced.cost) {
+                    dropEqualHops(localInfo, displaced.cost);
+                }
+                if (localInfo.altChannel == channel) {
+                    localInfo.altChannel = nullptr; // promoted to next hop
+                } else if (localInfo.altChannel) {
+                    offerAlternate(localInfo, localInfo.altNextHop, localInfo.altChannel, localInfo.altCost, localInfo.altSeq);
                 }
+                if (!isNew && displaced.channel != channel) {
+                    // a displaced next hop as near as the new one keeps carrying a share
+                    if (info.cost != displaced.cost || !offerEqualHop(localInfo, displaced.nextHop, displaced.channel, displaced.seq))
+                        offerAlternate(localInfo, displaced.nextHop, displaced.channel, displaced.cost, displaced.seq);
+                }
+                if (changed) {
+                    stateChanged = true;
+                    invalidateState();
+                    queueRouteUpdate(info.address, info.cost + 1, info.seq, channel);
+                }
+            } else if (localInfo.nextHop == info.nextHop) {
+                localInfo.lastSeen = now; // refreshed by the current next hop
+            } else if (info.cost == localInfo.cost && (equalHopIndex(localInfo, channel) >= 0 || info.seq == 0
+                                                       || localInfo.seq == 0 || !seqNewer(localInfo.seq, info.seq))) {
+                if (offerEqualHop(localInfo, info.nextHop, channel, info.seq)) {
+                    invalidateState();
+                    stateChanged = true;
+                }
+            } else {
+                int hop = equalHopIndex(localInfo, channel);
+                if (hop >= 0) {
+                    localInfo.equalHops.remove(hop); // no longer as near
+                    invalidateState();
+                }
+                offerAlternate(localInfo, info.nextHop, channel, info.cost, info.seq);
             }
         }
     } break;
 
     case Packet::NetState::SERVICE: {
         qDebug() << QString("router '%1' recv'd SERVICE update").arg(mAddress);
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        // a versioned advertisement already seen over another path is dropped unparsed
+        if (packet->seqNum != 0 && mFloodFilter.seen(FloodFilter::fingerprint(packet), now))
+            return;
         ServiceNodeInfo serviceInfo = parseNetServiceShare(packet);
         if (serviceInfo.err.length() > 0) {
             qDebug() << "error parsing net service: " << serviceInfo.err;
             return;
         }
-        {
-            QMutexLocker lock(&mMutex);
-            NodeCapacity* nodeCapacity = new NodeCapacity();
-            nodeCapacity->capacity = serviceInfo.capacity;
-            nodeCapacity->lastSeen = QDate::currentDate();
-
-
-            QMap<QString, NodeCapacity*> capcityMap;
-            if (serviceCapacityMap.contains(serviceInfo.service)) {
-                capcityMap = serviceCapacityMap[serviceInfo.service];
-                if (capcityMap.contains(serviceInfo.address)){
-                    if (nodeCapacity->capacity == 0) {
-                        capcityMap.remove(serviceInfo.address); // service
-                        return;
-                    } else if (capcityMap[serviceInfo.address]->capacity == nodeCapacity->capacity) {
-                        return; // drop redunant packet to avoid propagation loops
-                    }
-                }
-            }
-            if (nodeCapacity->capacity > 0) {
-                capcityMap.insert(serviceInfo.address, nodeCapacity);
-                serviceCapacityMap.insert(serviceInfo.service, capcityMap);
+        if (serviceInfo.address == mAddress) {
+            // local services are not indexed, but the mesh may hold a newer version
+            // of one from before a restart, or a service no longer hosted here
+            bool hosted = serviceExecutors.contains(serviceInfo.service);
+            if (serviceInfo.seq != 0 && (hosted ? seqNewer(serviceInfo.seq, mLocalServiceSeq.value(serviceInfo.service))
+                                                : serviceInfo.capacity != 0)) {
+                if (seqNewer(serviceInfo.seq, mServiceSeq))
+                    mServiceSeq = serviceInfo.seq;
+                queueLocalServiceUpdate(serviceInfo.service, hosted ? mLocalServiceLoad.value(serviceInfo.service).first : 0);
+                lock.unlock();
+                triggerUpdates();
             }
-            stateChanged = true;
+            return;
         }
-        // forward the service load
-        for (Channel* ch : channels) {
-            if (ch != channel) {
-                ch->send(packet);
+
+        QPair<QString, QString> key(serviceInfo.address, serviceInfo.service);
+        const NodeCapacity* current = serviceTable.find(serviceInfo.service, serviceInfo.address);
+        if (serviceInfo.seq != 0) {
+            auto withdrawn = mServiceWithdrawn.constFind(key);
+            if (withdrawn != mServiceWithdrawn.constEnd() && !seqNewer(serviceInfo.seq, withdrawn.value().first))
+                return; // stale news of a withdrawn service
+            if (current && current->seq != 0 && !seqNewer(serviceInfo.seq, current->seq)) {
+                if (serviceInfo.seq == current->seq)
+                    serviceTable.update(serviceInfo.service, serviceInfo.address, current->capacity, now, current->seq);
+                return; // not newer than the version held
             }
         }
+        // drop redundant packets to avoid propagation loops
+        if (!serviceTable.update(serviceInfo.service, serviceInfo.address, serviceInfo.capacity, now, serviceInfo.seq))
+            return;
+        if (serviceInfo.capacity == 0 && serviceInfo.seq != 0) {
+            mServiceWithdrawn.insert(key, qMakePair(serviceInfo.seq, now));
+        } else {
+            mServiceWithdrawn.remove(key);
+        }
+        if (!current && mServiceExpiry > 0) {
+            mExpiryWheel.schedule(now + mServiceExpiry, key);
+        }
+        stateChanged = true;
+        invalidateState();
+        // forward the service load
+        queueServiceUpdate(serviceInfo.address, serviceInfo.service, serviceInfo.capacity, serviceInfo.seq, channel);
     } break;
 
-    case Packet::NetState::QUERY:
+    case Packet::NetState::QUERY: {
         qDebug() << QString("router '%1' recv'd QUERY").arg(mAddress);
-        for (Packet* p : exportRouteTable())
+        QString address = parseNetQuery(packet);
+        if (address.length() > 0) {
+            // targeted query: answer with the one route, or ask the other
+            // neighbors; a route found by them reaches the querier in the
+            // triggered update that follows its installation here
+            Packet* reply = nullptr;
+            QVector<Channel*> targets;
+            {
+                QMutexLocker lock(&mMutex);
+                RouteTable::Handle route = routeTable.find(address);
+                if (address == mAddress) {
+                    reply = composeNetRouteShare(mAddress, (short) 1, mSeq);
+                } else if (route != RouteTable::NoRoute) {
+                    const RouteEntry& entry = routeTable.at(route);
+                    if (!routesThrough(entry, channel)) // never back to a next hop
+                        reply = composeNetRouteShare(address, (short) (entry.cost + 1), entry.seq);
+                } else if (!mQueryFilter.seen(FloodFilter::fingerprint(packet), mClock.elapsed())) {
+                    targets = channels;
+                    targets.removeAll(channel);
+                }
+            }
+            if (reply)
+                channel->send(reply);
+            for (Channel* ch : targets)
+                ch->send(composeNetQuery(address));
+            break;
+        }
+        QList<Packet*> routes, services;
+        {
+            QMutexLocker lock(&mMutex);
+            routes = exportRouteTable(channel);
+            services = exportServiceTable();
+        }
+        for (Packet* p : routes)
             channel->send(p);
-        for (Packet* p : exportServiceTable())
+        for (Packet* p : services)
             channel->send(p);
-        break;
+    } break;
     }
 
-    if (stateChanged)
+    if (relay)
+        relayChannel->send(relay);
+    for (Packet* p : pending)
+        send(p);
+    if (stateChanged) {
+        triggerUpdates();
         emit netStateChanged();
+    }
 }
 
 void Router::onPacket(Channel* channel, Packet* packet) {
     qDebug() << "Router::onPacket from" << packet->srcAddress << ":" << QString(packet->data);
     if (packet->net != 0) {
         handleNetState(channel, packet);
+        delete packet;
     } else {
         send(packet);
     }
@@ -347,71 +1215,444 @@ void Router::removeChannel(Channel* ch) {
     qDebug() << "router:RemoveChannel";
     disconnect(ch, SIGNAL(packetReceived(Channel*,Packet*)), this, SLOT(onPacket(Channel*,Packet*)));
     disconnect(ch, SIGNAL(closing(Channel*)), this, SLOT(onChannelClose(Channel*)));
+    QList<QPair<Channel*, Packet*>> requests;
     {
         QMutexLocker lock(&mMutex);
         channels.remove(channels.indexOf(ch));
-        // bcast the loss of routes through the channel
-        foreach (QString address, remoteNodeMap.keys()) {
-            qDebug() << QString("router:RemoveChannel address '%1'").arg(address);
-            RemoteNodeInfo* nodeInfo = remoteNodeMap[address];
-            if (nodeInfo->channel == ch) {
-                removeAddress(address);
-                foreach (Channel* c, channels) {
-                    c->send(composeNetRouteShare(address, (short) 0));
+        QList<RouteTable::Handle> lostRoutes;
+        foreach (RouteTable::Handle route, routeTable.handles()) {
+            RouteEntry& entry = routeTable.at(route);
+            if (entry.altChannel == ch) {
+                entry.altChannel = nullptr;
+            }
+            int hop = equalHopIndex(entry, ch);
+            if (hop >= 0) {
+                entry.equalHops.remove(hop);
+                invalidateState();
+            }
+            if (entry.channel == ch) {
+                lostRoutes.append(route);
+            }
+        }
+        foreach (RouteTable::Handle route, lostRoutes) {
+            RouteEntry& entry = routeTable.at(route);
+            if (!entry.equalHops.isEmpty()) {
+                // the remaining equal-cost paths carry the route at the same cost
+                promoteEqualHop(entry);
+                invalidateState();
+            } else if (entry.altChannel) {
+                // fast reroute: the alternate's path does not use this channel
+                qDebug() << QString("router:RemoveChannel address '%1' rerouted via '%2'").arg(entry.address, entry.altNextHop);
+                promoteAlternate(entry);
+                invalidateState();
+                queueRouteUpdate(entry.address, entry.cost + 1, entry.seq, entry.channel);
+                if (entry.seq != 0) {
+                    // the alternate need not be the shortest path; a withdrawal sent
+                    // along it is relayed to the origin, whose next number lets
+                    // every node reselect (see handleNetState)
+                    requests.append(qMakePair(entry.channel, composeNetRouteShare(entry.address, 0, entry.seq | 1)));
                 }
+            } else {
+                // bcast the loss of routes through the channel
+                qDebug() << QString("router:RemoveChannel address '%1'").arg(entry.address);
+                withdrawRoute(route, nullptr);
             }
         }
     }
+    for (auto request : requests)
+        request.first->send(request.second);
+    // neighbors forwarding through this node learn of the loss without waiting
+    // out the update window
+    flushUpdates();
+    // the caller may delete the channel once no sender can still reach it
+    publishState();
+    waitForSenders();
     emit channelsChanged();
     emit netStateChanged();
 }
 
-void Router::registerService(QString service, PacketHandler* handler) {
+void Router::registerService(QString service, PacketHandler* handler, int workers, int queueLimit,
+                             ServiceExecutor::Overflow overflow) {
+    std::shared_ptr<ServiceExecutor> executor =
+        std::make_shared<ServiceExecutor>(service, handler, &mServicePool, workers, queueLimit, overflow);
     QMutexLocker lock(&mMutex);
-    serviceHandlerMap.insert(service, handler);
+    std::shared_ptr<ServiceExecutor> replaced = serviceExecutors.value(service);
+    serviceExecutors.insert(service, executor);
+    resizeServicePool();
+    invalidateState();
+    queueLocalServiceUpdate(service, 1);
+    lock.unlock();
+    if (replaced)
+        replaced->shutdown();
+    triggerUpdates();
 }
 
 void Router::unregisterService(QString service) {
     QMutexLocker lock(&mMutex);
-    serviceHandlerMap.remove(service);
+    std::shared_ptr<ServiceExecutor> executor = serviceExecutors.take(service);
+    resizeServicePool();
+    invalidateState();
+    queueLocalServiceUpdate(service, 0);
+    lock.unlock();
+    // senders holding an older forwarding state find the executor closed
+    if (executor)
+        executor->shutdown();
+    triggerUpdates();
+}
+
+// resizeServicePool gives the pool one thread per executor worker; callers hold mMutex
+void Router::resizeServicePool() {
+    int threads = 0;
+    for (const std::shared_ptr<ServiceExecutor>& executor : serviceExecutors)
+        threads += executor->workers();
+    mServicePool.setMaxThreadCount(qMax(threads, 1));
+}
+
+void Router::setRouteExpiry(int ms) {
+    QMutexLocker lock(&mMutex);
+    mRouteExpiry = qMax(ms, 0);
+    resetExpiry();
+}
+
+void Router::setServiceExpiry(int ms) {
+    QMutexLocker lock(&mMutex);
+    mServiceExpiry = qMax(ms, 0);
+    resetExpiry();
 }
 
-QList<Packet*> Router::exportRouteTable() {
+// resetExpiry schedules one expiry check per route and service under the current intervals
+void Router::resetExpiry() {
+    qint64 now = mClock.elapsed();
+    mExpiryWheel = TimerWheel<QPair<QString, QString>>(ROUTER_EXPIRY_TICK_MS, now);
+    if (mRouteExpiry > 0) {
+        foreach (RouteTable::Handle route, routeTable.handles()) {
+            const RouteEntry& entry = routeTable.at(route);
+            mExpiryWheel.schedule(entry.lastSeen + mRouteExpiry, qMakePair(entry.address, QString()));
+        }
+    }
+    if (mServiceExpiry > 0) {
+        foreach (QString service, serviceTable.services()) {
+            const ServiceInstances* instances = serviceTable.find(service);
+            for (auto it = instances->byLoad.constBegin(); it != instances->byLoad.constEnd(); ++it) {
+                mExpiryWheel.schedule(it.value().lastSeen + mServiceExpiry, qMakePair(it.key().second, service));
+            }
+        }
+    }
+    updateTimer();
+}
+
+// updateTimer runs the expiry timer while anything can expire; callers hold mMutex
+void Router::updateTimer() {
+    bool needed = mRouteExpiry > 0 || mServiceExpiry > 0 || contextTable.pendingDeadlines() > 0 || !mPending.isEmpty();
+    if (needed != mExpiryTimer.isActive()) {
+        // the timer belongs to the router's thread
+        QMetaObject::invokeMethod(&mExpiryTimer, needed ? "start" : "stop", Qt::QueuedConnection);
+    }
+}
+
+void Router::onExpiryTick() {
+    bool stateChanged = false;
+    QList<ContextTable::Context> expiredContexts;
+    {
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        expiredContexts = contextTable.expire(now);
+        foreach (ContextTable::Context context, expiredContexts)
+            pinHandler(context.first, context.second);
+        int unrouted = mPending.expire(now);
+        if (unrouted > 0)
+            qDebug() << QString("router '%1' dropped %2 packets that found no route").arg(mAddress).arg(unrouted);
+        foreach (auto key, mExpiryWheel.advance(now)) {
+            qint64 deadline;
+            if (key.second.isEmpty()) {
+                RouteTable::Handle route = routeTable.find(key.first);
+                if (route == RouteTable::NoRoute || mRouteExpiry == 0)
+                    continue;
+                // unsequenced routes come from peers that never re-advertise, so
+                // they are kept until withdrawn and checked again in case the
+                // destination starts numbering its routes
+                const RouteEntry& entry = routeTable.at(route);
+                deadline = entry.seq != 0 ? entry.lastSeen + mRouteExpiry : now + mRouteExpiry;
+            } else {
+                const NodeCapacity* capacity = serviceTable.find(key.second, key.first);
+                if (!capacity || mServiceExpiry == 0)
+                    continue;
+                deadline = capacity->seq != 0 ? capacity->lastSeen + mServiceExpiry : now + mServiceExpiry;
+            }
+            if (deadline > now) {
+                mExpiryWheel.schedule(deadline, key); // refreshed since this check was scheduled
+                continue;
+            }
+
+            if (key.second.isEmpty()) {
+                qDebug() << QString("router '%1' route to '%2' expired").arg(mAddress, key.first);
+                withdrawRoute(routeTable.find(key.first), nullptr);
+                stateChanged = true;
+            } else {
+                qDebug() << QString("router '%1' service '%2' at '%3' expired").arg(mAddress, key.second, key.first);
+                // withdrawn as version seq|1, like a route lost with its next hop
+                INT16U seq = serviceTable.find(key.second, key.first)->seq;
+                if (seq != 0) {
+                    seq |= 1;
+                    mServiceWithdrawn.insert(key, qMakePair(seq, now));
+                }
+                serviceTable.remove(key.second, key.first);
+                invalidateState();
+                queueServiceUpdate(key.first, key.second, 0, seq, nullptr);
+                stateChanged = true;
+            }
+        }
+        updateTimer();
+    }
+
+    foreach (ContextTable::Context context, expiredContexts) {
+        if (context.second)
+            context.second->onTimeout(context.first);
+        unpinHandler(context.second);
+    }
+    if (stateChanged) {
+        triggerUpdates();
+        emit netStateChanged();
+    }
+}
+
+// exportRouteTable returns the routing table as advertised to channel ch; routes
+// learned from ch are left out, or poisoned when poison reverse is enabled.
+// Callers hold mMutex.
+QList<Packet*> Router::exportRouteTable(Channel* ch) {
     QList<Packet*> routes;
-    routes.append(composeNetRouteShare(mAddress, (short) 1));
-    foreach (QString address, remoteNodeMap.keys()) {
-        RemoteNodeInfo* routeInfo = remoteNodeMap[address];
-        routes.append(composeNetRouteShare(address, (short) (routeInfo->cost + 1)));
+    routes.append(composeNetRouteShare(mAddress, (short) 1, mSeq));
+    foreach (RouteTable::Handle route, routeTable.handles()) {
+        const RouteEntry& routeInfo = routeTable.at(route);
+        if (!routesThrough(routeInfo, ch)) {
+            routes.append(composeNetRouteShare(routeInfo.address, (short) (routeInfo.cost + 1), routeInfo.seq));
+        } else if (mPoisonReverse) {
+            routes.append(composeNetRouteShare(routeInfo.address, (short) ROUTE_COST_INFINITY, routeInfo.seq));
+        }
     }
     return routes;
 }
 
 QList<Packet*> Router::exportServiceTable() {
     QList<Packet*> services;
-    foreach (QString service, serviceHandlerMap.keys()) {
-        services.append(composeNetServiceShare(mAddress, service, (short) 1));
+    foreach (QString service, serviceExecutors.keys()) {
+        services.append(composeNetServiceShare(mAddress, service, mLocalServiceLoad.value(service).first, mLocalServiceSeq.value(service)));
     }
-    foreach (QString service, serviceCapacityMap.keys()) {
-        QMap<QString, NodeCapacity*> loadMap = serviceCapacityMap[service];
-        foreach (QString address, loadMap.keys()) {
-            NodeCapacity* loadInfo = loadMap[address];
-            services.append(composeNetServiceShare(address, service, loadInfo->capacity));
+    foreach (QString service, serviceTable.services()) {
+        const ServiceInstances* instances = serviceTable.find(service);
+        for (auto it = instances->byLoad.constBegin(); it != instances->byLoad.constEnd(); ++it) {
+            services.append(composeNetServiceShare(it.key().second, service, it.value().capacity, it.value().seq));
         }
     }
     return services;
 }
 
 void Router::shareNetState() {
-    QList<Packet*> routes, services;
-    {
-        QMutexLocker lock(&mMutex);
-        routes = exportRouteTable();
+    QMutexLocker lock(&mMutex);
+    QVector<Channel*> targets = channels;
+    lock.unlock();
+    for (Channel* ch : targets) {
+        QList<Packet*> routes, services;
+        lock.relock();
+        routes = exportRouteTable(ch);
         services = exportServiceTable();
-    }
-    for (Channel* ch : channels) {
+        lock.unlock();
         for (Packet* p : routes)
             ch->send(p);
         for (Packet* p : services)
             ch->send(p);
     }
 }
+
+void Router::setPoisonReverse(bool enabled) {
+    QMutexLocker lock(&mMutex);
+    mPoisonReverse = enabled;
+}
+
+void Router::setLoadInterval(int ms) {
+    {
+        QMutexLocker lock(&mMutex);
+        mLoadInterval = qMax(ms, 0);
+        if (mLoadInterval == 0) {
+            // back to a constant load
+            foreach (QString service, serviceExecutors.keys()) {
+                if (mLocalServiceLoad.value(service).first != 1)
+                    queueLocalServiceUpdate(service, 1);
+            }
+        }
+    }
+    triggerUpdates();
+}
+
+// onLoadTimer measures each local service and advertises the loads that have
+// moved past the hysteresis band, once the service's interval has passed
+void Router::onLoadTimer() {
+    {
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        mOutliers.prune(now, ROUTER_OUTLIER_IDLE_MS);
+        mUnhealthy.store(mOutliers.unhealthy());
+        if (mLoadInterval == 0)
+            return;
+        for (auto it = serviceExecutors.constBegin(); it != serviceExecutors.constEnd(); ++it) {
+            short load = (short) qBound(1, 1 + qRound(it.value()->expectedDelay()), 0x7FFF);
+            QPair<short, qint64> advertised = mLocalServiceLoad.value(it.key());
+            int change = qAbs(load - advertised.first);
+            if (change < 2 || change < advertised.first * ROUTER_LOAD_HYSTERESIS)
+                continue;
+            if (now - advertised.second < mLoadInterval)
+                continue;
+            queueLocalServiceUpdate(it.key(), load);
+        }
+    }
+    triggerUpdates();
+}
+
+void Router::setPendingTimeout(int ms) {
+    QMutexLocker lock(&mMutex);
+    mPending.setTtl(qMax(ms, 0));
+    if (ms <= 0)
+        mPending.clear();
+}
+
+void Router::setUpdateWindow(int ms) {
+    {
+        QMutexLocker lock(&mMutex);
+        mUpdateWindow = qMax(ms, 0);
+        mUpdateTimer.setInterval(mUpdateWindow);
+    }
+    triggerUpdates();
+}
+
+// queueRouteUpdate records a triggered route update; callers hold mMutex
+void Router::queueRouteUpdate(QString address, short cost, INT16U seq, Channel* origin) {
+    PendingUpdate update;
+    update.value = cost;
+    update.seq = seq;
+    update.origin = origin;
+    mPendingRoutes.insert(address, update);
+}
+
+// queueServiceUpdate records a triggered service update; callers hold mMutex
+void Router::queueServiceUpdate(QString address, QString service, short load, INT16U seq, Channel* origin) {
+    PendingUpdate update;
+    update.value = load;
+    update.seq = seq;
+    update.origin = origin;
+    mPendingServices.insert(qMakePair(address, service), update);
+}
+
+// queueLocalServiceUpdate advertises a local service under a new version; callers hold mMutex
+void Router::queueLocalServiceUpdate(QString service, short load) {
+    mServiceSeq = nextSeq(mServiceSeq);
+    if (load > 0) {
+        mLocalServiceSeq.insert(service, mServiceSeq);
+        mLocalServiceLoad.insert(service, qMakePair(load, mClock.elapsed()));
+    } else {
+        mLocalServiceSeq.remove(service);
+        mLocalServiceLoad.remove(service);
+    }
+    queueServiceUpdate(mAddress, service, load, mServiceSeq, nullptr);
+}
+
+// triggerUpdates sends the pending updates now, or once the window closes
+void Router::triggerUpdates() {
+    QMutexLocker lock(&mMutex);
+    if (mPendingRoutes.isEmpty() && mPendingServices.isEmpty())
+        return;
+    if (mUpdateWindow > 0) {
+        if (!mUpdateTimer.isActive())
+            QMetaObject::invokeMethod(&mUpdateTimer, "start", Qt::QueuedConnection);
+        return;
+    }
+    lock.unlock();
+    flushUpdates();
+}
+
+void Router::flushUpdates() {
+    QHash<QString, PendingUpdate> routes;
+    QHash<QPair<QString, QString>, PendingUpdate> services;
+    QVector<Channel*> targets;
+    // channels each updated route leaves on, which are not advertised the route
+    QHash<QString, QVector<Channel*>> paths;
+    bool poisonReverse;
+    {
+        QMutexLocker lock(&mMutex);
+        routes.swap(mPendingRoutes);
+        services.swap(mPendingServices);
+        targets = channels;
+        poisonReverse = mPoisonReverse;
+        for (auto it = routes.constBegin(); it != routes.constEnd(); ++it) {
+            RouteTable::Handle route = it.value().value != 0 ? routeTable.find(it.key()) : RouteTable::NoRoute;
+            if (route == RouteTable::NoRoute)
+                continue;
+            const RouteEntry& entry = routeTable.at(route);
+            QVector<Channel*>& leaves = paths[it.key()];
+            leaves.append(entry.channel);
+            for (const RouteHop& hop : entry.equalHops)
+                leaves.append(hop.channel);
+        }
+    }
+    for (Channel* ch : targets) {
+        for (auto it = routes.constBegin(); it != routes.constEnd(); ++it) {
+            if (it.value().origin != ch && !paths.value(it.key()).contains(ch)) {
+                ch->send(composeNetRouteShare(it.key(), it.value().value, it.value().seq));
+            } else if (poisonReverse && it.value().value != 0) {
+                // the next hop is told it cannot reach the address through this node
+                ch->send(composeNetRouteShare(it.key(), (short) ROUTE_COST_INFINITY, it.value().seq));
+            }
+        }
+        for (auto it = services.constBegin(); it != services.constEnd(); ++it) {
+            if (it.value().origin != ch)
+                ch->send(composeNetServiceShare(it.key().first, it.key().second, it.value().value, it.value().seq));
+        }
+    }
+}
+
+void Router::setRefreshInterval(int ms) {
+    {
+        QMutexLocker lock(&mMutex);
+        mRefreshInterval = qMax(ms, 0);
+        mFloodFilter.setWindow(mRefreshInterval > 0 ? qMin(ROUTER_FLOOD_WINDOW_MS, mRefreshInterval / 4) : ROUTER_FLOOD_WINDOW_MS);
+    }
+    scheduleRefresh();
+}
+
+// scheduleRefresh arms the refresh timer with up to 25% jitter either way, so
+// neighbors that started together do not advertise in lockstep
+void Router::scheduleRefresh() {
+    QMutexLocker lock(&mMutex);
+    if (mRefreshInterval == 0) {
+        QMetaObject::invokeMethod(&mRefreshTimer, "stop", Qt::QueuedConnection);
+        return;
+    }
+    int interval = (int)(mRefreshInterval * (0.75 + 0.5 * QRandomGenerator::global()->generateDouble()));
+    QMetaObject::invokeMethod(&mRefreshTimer, "start", Qt::QueuedConnection, Q_ARG(int, interval));
+}
+
+// onRefreshTimer advertises the full tables under a new sequence number, which
+// lets neighbors replace routes that were withdrawn or damaged while a change
+// propagated
+void Router::onRefreshTimer() {
+    {
+        QMutexLocker lock(&mMutex);
+        qint64 now = mClock.elapsed();
+        mSeq = nextSeq(mSeq);
+        mLastShare = now;
+        // a withdrawal older than a few refreshes can no longer be outbid by stale news
+        for (auto it = mWithdrawn.begin(); it != mWithdrawn.end();) {
+            if (now - it.value().second > 3 * (qint64)mRefreshInterval)
+                it = mWithdrawn.erase(it);
+            else
+                ++it;
+        }
+        for (auto it = mServiceWithdrawn.begin(); it != mServiceWithdrawn.end();) {
+            if (now - it.value().second > 3 * (qint64)mRefreshInterval)
+                it = mServiceWithdrawn.erase(it);
+            else
+                ++it;
+        }
+    }
+    shareNetState();
+    scheduleRefresh();
+}
@@ -1,11 +1,30 @@
 #ifndef ROUTER_H
 #define ROUTER_H
 
-#include <QDate>
-#include <QDate>
+#include <QElapsedTimer>
+#include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QPair>
+#include <QThreadPool>
+#include <QTimer>
+#include <QWaitCondition>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include "channel.h"
+#include "contexttable.h"
+#include "floodfilter.h"
+#include "hashring.h"
+#include "latencywindow.h"
+#include "outlierdetector.h"
+#include "pendingqueue.h"
+#include "responsecache.h"
+#include "routetable.h"
+#include "servicebalancer.h"
+#include "serviceexecutor.h"
+#include "servicetable.h"
+#include "timerwheel.h"
 #include "quuid.h"
 
 
@@ -15,6 +34,7 @@ public:
     QString nextHop; // next routing node for address
     Channel* channel; // specific channel that is hosting next hop
     short cost; // cost of using this route, generally a hop count
+    INT16U seq; // origin's sequence number; zero when the sender does not sequence routes
     QString err;
 };
 
@@ -24,77 +44,390 @@ public:
     QString address; // host of the service
     QString nextHop; // next routing node for address
     short capacity; // remote service capacity (must be gte 1)
+    INT16U seq; // host's version of the advertisement; zero when unversioned
     QString err; // parser error
 };
 
-class NodeCapacity {
-public:
-    short capacity;
-    QDate lastSeen;
-};
+class RequestHandler;
 
 class PacketHandler : public QObject {
     Q_OBJECT
 public:
+    // onPacket is called on a worker thread of the service's executor, or on the
+    // sending thread for context handlers; the packet is deleted when it returns
     virtual void onPacket(Packet*) = 0;
+    // onTimeout is called when a context registered with a timeout expires; the
+    // context has already been released
+    virtual void onTimeout(INT16U ctx) { Q_UNUSED(ctx); }
 signals:
     void packetReceived(Packet* packet);
 };
 
 
+// ResponseCallback receives each response to a request; returning true keeps
+// the context open for further responses until the request times out
+typedef std::function<bool(Packet*)> ResponseCallback;
+typedef std::function<void()> TimeoutCallback;
+
+// ForwardingState is an immutable copy of the tables consulted when sending.
+// The router publishes a new version after each batch of table changes and
+// senders on any thread route by the current version without taking the
+// router lock; a sender that finds it out of date rebuilds it under the lock.
+class ForwardingState {
+public:
+    RouteTable routes;
+    QHash<QString, QStringList> services; // service -> remote hosts, least loaded first
+    QHash<QString, QVector<short>> serviceLoads; // service -> loads of its remote hosts, in the same order
+    QHash<QString, ServiceBalancer::Policy> balance; // services not balanced by least load
+    QHash<QString, HashRing> rings; // services balanced by affinity -> their remote hosts
+    QHash<QString, std::shared_ptr<ServiceExecutor>> localServices;
+};
+
+// resolution of route and service expiry
+#define ROUTER_EXPIRY_TICK_MS 250
+// interval of the expiry timer, which also bounds the resolution of context timeouts
+#define ROUTER_TIMER_INTERVAL_MS 50
+
+// default window over which triggered updates are coalesced
+#define ROUTER_UPDATE_WINDOW_MS 50
+
+// PendingUpdate is a triggered route or service update awaiting the coalescing window
+class PendingUpdate {
+public:
+    short value; // route cost or service load; zero withdraws
+    INT16U seq; // route sequence number or service version
+    Channel* origin; // channel the change was learned from, which is not told
+};
+
+// HedgePolicy is the hedging setup of a service and the response times it is based on
+class HedgePolicy {
+public:
+    double percentile = 0; // of response times, after which a second instance is asked
+    double rate = 0; // largest fraction of requests that are hedged
+    double budget = 0; // hedges that may be sent now; each request adds rate
+    LatencyWindow latency;
+};
+
+// cost of a poisoned route; a neighbor routing to the address through the
+// receiver advertises it back at this cost (ALN_PROTOCOL.md section 5.1)
+#define ROUTE_COST_INFINITY 0xFFFF
+
+// most next hops kept per route for equal-cost multipath
+#define ROUTER_MAX_PATHS 4
+
+// default interval of full table advertisements; each is jittered by up to 25%
+#define ROUTER_REFRESH_INTERVAL_MS 30000
+// full tables are not re-sent more often than this on request
+#define ROUTER_MIN_SHARE_INTERVAL_MS 1000
+// default expiry of sequenced routes and services; three refresh intervals,
+// so two periodic advertisements in a row may be lost
+#define ROUTER_EXPIRY_MS (3 * ROUTER_REFRESH_INTERVAL_MS)
+
+// longest time a flooded service advertisement is remembered as seen; capped
+// at a quarter of the refresh interval so periodic advertisements still pass
+#define ROUTER_FLOOD_WINDOW_MS 5000
+
+// default time a packet to a destination without a route waits for one
+#define ROUTER_PENDING_TTL_MS 3000
+// bounds on the packets waiting for routes, per destination and in bytes overall
+#define ROUTER_PENDING_PER_ADDRESS 64
+#define ROUTER_PENDING_MEMORY (1 << 20)
+
+// default worker threads and queue bound of a local service's executor
+#define ROUTER_SERVICE_WORKERS 1
+#define ROUTER_SERVICE_QUEUE 256
+
+// the load advertised for a local service is one plus the ms a new request
+// would wait and run for: its executor's average handler call duration times
+// the calls queued, running and new, divided by its worker threads. It is
+// measured at this interval.
+#define ROUTER_LOAD_SAMPLE_MS 250
+// default shortest interval between load advertisements of one service
+#define ROUTER_LOAD_INTERVAL_MS 1000
+// a measured load is advertised once it differs from the advertised load by
+// this fraction of it, and by at least 2
+#define ROUTER_LOAD_HYSTERESIS 0.25
+
+// points per host on a service's affinity ring
+#define ROUTER_AFFINITY_REPLICAS 64
+// hosts loaded beyond this multiple of the mean are skipped by affinity
+#define ROUTER_AFFINITY_BALANCE 1.25
+
+// default percentile of a service's response times after which a hedged
+// request is sent to a second instance, and fraction of requests hedged at most
+#define ROUTER_HEDGE_PERCENTILE 0.95
+#define ROUTER_HEDGE_RATE 0.05
+// response times a service needs before its requests are hedged
+#define ROUTER_HEDGE_MIN_SAMPLES 16
+// most hedges a service saves up while its requests are answered in time
+#define ROUTER_HEDGE_BURST 10
+
+// timeouts in a row, and response time as a multiple of the median of the
+// other instances, after which a service instance is ejected from selection
+#define ROUTER_OUTLIER_FAILURES 5
+#define ROUTER_OUTLIER_SLOW_FACTOR 3.0
+// first and longest ejection; each ejection in a row doubles it
+#define ROUTER_OUTLIER_EJECTION_MS 1000
+#define ROUTER_OUTLIER_MAX_EJECTION_MS 30000
+// largest fraction of a service's instances ejected at once
+#define ROUTER_OUTLIER_MAX_EJECTED 0.5
+// instances sent no requests for this long are forgotten
+#define ROUTER_OUTLIER_IDLE_MS 60000
+
+// default bound on the bytes of cached responses
+#define ROUTER_CACHE_MEMORY (1 << 20)
+
 class Router : public QObject
 {
     Q_OBJECT
     QMutex mMutex;
     QString mAddress = QUuid::createUuid().toString(QUuid::StringFormat::WithoutBraces);
 
-    QHash<short, PacketHandler*> contextHandlerMap;
-    QHash<QString, PacketHandler*> serviceHandlerMap;
+    ContextTable contextTable;
+    // context handler calls running without the lock; releaseContext waits for
+    // those on other threads, so the handler's owner may then delete it
+    struct HandlerCall {
+        INT16U ctx;
+        PacketHandler* handler;
+        Qt::HANDLE thread;
+    };
+    QList<HandlerCall> mHandlerCalls;
+    QWaitCondition mHandlerIdle;
+    QHash<QString, std::shared_ptr<ServiceExecutor>> serviceExecutors;
+    // workers of every service executor; sized to their sum so each service
+    // can always run its full share
+    QThreadPool mServicePool;
 
-    // map[address]RemoteNode
-    QMap<QString, RemoteNodeInfo*> remoteNodeMap;
+    // routes to remote nodes by address
+    RouteTable routeTable;
 
-    // map[service][address]NodeLoad
-    QMap<QString, QMap<QString, NodeCapacity*>> serviceCapacityMap;
+    // remote service hosts by service, ordered by load
+    ServiceTable serviceTable;
 
     QVector<Channel*> channels;
 
+    // current forwarding state; rebuilt at most once per batch of table changes
+    std::shared_ptr<const ForwardingState> mState;
+    std::atomic<bool> mStateStale;
+    // replaced states that senders may still be reading; removeChannel waits
+    // for them since they can route through the removed channel
+    QList<std::weak_ptr<const ForwardingState>> mRetired;
+
+    // monotonic clock for the age of routes and services
+    QElapsedTimer mClock;
+    // expiry intervals in ms; zero disables expiry
+    int mRouteExpiry = ROUTER_EXPIRY_MS;
+    int mServiceExpiry = ROUTER_EXPIRY_MS;
+    // pending expiry checks of (address, service); an empty service names the route
+    TimerWheel<QPair<QString, QString>> mExpiryWheel;
+    QTimer mExpiryTimer;
+
+    // triggered updates gathered over the window; the latest value wins
+    QHash<QString, PendingUpdate> mPendingRoutes; // by address
+    QHash<QPair<QString, QString>, PendingUpdate> mPendingServices; // by (address, service)
+    int mUpdateWindow = ROUTER_UPDATE_WINDOW_MS;
+    QTimer mUpdateTimer;
+
+    // DSDV-style sequence number of this node's own route; even while the
+    // node is reachable, advanced on every periodic advertisement
+    INT16U mSeq = 2;
+    // sequence numbers of withdrawn routes, so stale advertisements of them are rejected
+    QHash<QString, QPair<INT16U, qint64>> mWithdrawn;
+    int mRefreshInterval = ROUTER_REFRESH_INTERVAL_MS;
+    QTimer mRefreshTimer;
+    qint64 mLastShare = -ROUTER_MIN_SHARE_INTERVAL_MS;
+    bool mPoisonReverse = false;
+
+    // versions of this node's service advertisements, advanced on every change
+    INT16U mServiceSeq = 0;
+    QHash<QString, INT16U> mLocalServiceSeq; // by local service
+    // advertised load of local services and when it was advertised
+    QHash<QString, QPair<short, qint64>> mLocalServiceLoad;
+    int mLoadInterval = ROUTER_LOAD_INTERVAL_MS;
+    QTimer mLoadTimer;
+
+    QHash<QString, ServiceBalancer::Policy> mBalance;
+    // requests sent by Router::request and awaiting a response, by destination
+    QHash<QString, int> mOutstanding;
+    friend class RequestHandler;
+    // services whose requests are hedged
+    QHash<QString, HedgePolicy> mHedging;
+    // hedges not yet sent, by deadline: (context, its request)
+    QMultiMap<qint64, QPair<INT16U, RequestHandler*>> mHedges;
+    QTimer mHedgeTimer;
+    // responses of idempotent services, and how long each service's are kept
+    ResponseCache mResponseCache;
+    QHash<QString, int> mCacheTtl;
+    // health of the remote service instances requests were sent to
+    OutlierDetector mOutliers;
+    bool mOutlierDetection = true;
+    std::atomic<int> mUnhealthy; // instances ejected or on probation
+    // versions of withdrawn services by (address, service), as for routes
+    QHash<QPair<QString, QString>, QPair<INT16U, qint64>> mServiceWithdrawn;
+    FloodFilter mFloodFilter;
+
+    // per-router seed of the flow hash that picks among equal-cost next hops
+    uint mFlowSeed;
+
+    // packets waiting for a route to their destination
+    PendingQueue mPending;
+    // route queries recently sent or relayed, so each is relayed once
+    FloodFilter mQueryFilter;
+
 public:
     Router(QString address = QString());
+    ~Router();
     QString address() { return mAddress; }
 
     void addChannel(Channel*);
+    // removeChannel returns once no sender can still send on the channel, after
+    // which it may be deleted. It must not be called while the calling thread
+    // holds a forwarding state, as in a context handler run by send.
     void removeChannel(Channel*);
 
 
     QStringList selectServiceAddresses(QString);
-    QString selectServiceAddress(QString service);  // returns the least load node with service
-    QString send(Packet* p);
-    void registerService(QString service, PacketHandler* handler);
+    // selectServiceAddress returns this node if it hosts service, or else the
+    // remote host chosen by the service's balancing policy. Services balanced by
+    // Affinity go to the host key maps to, or the least loaded without a key.
+    QString selectServiceAddress(QString service, QByteArray key = QByteArray());
+    // requests with no destination go to the instance of service chosen by policy;
+    // the default is the least loaded. Packets sent to a service by Affinity go to
+    // one instance rather than all of them.
+    void setBalancePolicy(QString service, ServiceBalancer::Policy policy);
+    // send delivers p toward its destination; a packet with only a service goes
+    // to every instance, or to the one its key maps to when the service is
+    // balanced by Affinity. An empty key stands for the packet's source and context.
+    // send owns p; it is deleted when an error is returned.
+    QString send(Packet* p, QByteArray key = QByteArray());
+    // registerService delivers packets for service to handler on up to workers
+    // threads, keeping the packets of each (source, context) in order; at most
+    // queueLimit packets wait, beyond which overflow decides what is dropped.
+    // Zero workers calls the handler on the sending thread.
+    void registerService(QString service, PacketHandler* handler, int workers = ROUTER_SERVICE_WORKERS,
+                         int queueLimit = ROUTER_SERVICE_QUEUE,
+                         ServiceExecutor::Overflow overflow = ServiceExecutor::Reject);
+    // unregisterService returns once no call of the service's handler is running;
+    // it must not be called from that handler
     void unregisterService(QString service);
-    short registerContextHandler(PacketHandler*);
-    void releaseContext(short);
+    // registerContextHandler returns a context id for handler's responses, or 0
+    // when all ids are in use; a context with a timeout is released after
+    // timeoutMs and its handler's onTimeout is called
+    INT16U registerContextHandler(PacketHandler*, int timeoutMs = 0);
+    // releaseContext returns once no call of the context's handler is running
+    // on another thread, after which the handler may be deleted. A handler may
+    // release its own context; it must not wait on the releasing thread.
+    void releaseContext(INT16U);
+
+    // request sends data to service at dest, or to the service's preferred
+    // instance when dest is empty, and routes the responses to onResponse. The
+    // context is released after the first response unless onResponse returns
+    // true, or when timeoutMs passes, in which case onTimeout is called; the
+    // timeout must be positive so every request ends. Returns an empty string
+    // once the request is sent.
+    QString request(QString dest, QString service, QByteArray data, int timeoutMs,
+                    ResponseCallback onResponse, TimeoutCallback onTimeout = TimeoutCallback());
+    // as above, but the request also ends when receiver is destroyed, after
+    // which neither callback is called
+    QString request(QString dest, QString service, QByteArray data, int timeoutMs, QObject* receiver,
+                    ResponseCallback onResponse, TimeoutCallback onTimeout = TimeoutCallback());
+
+    // routes and services that are not re-advertised within the interval are
+    // withdrawn; zero keeps them until they are withdrawn explicitly. Only
+    // entries carrying a sequence number expire: unsequenced ones come from
+    // peers that advertise once and never refresh. The default suits
+    // neighbors refreshing at ROUTER_REFRESH_INTERVAL_MS; with a longer
+    // refresh interval the expiry should be raised to match.
+    void setRouteExpiry(int ms);
+    void setServiceExpiry(int ms);
+    // route and service changes are advertised in one batch per window;
+    // zero advertises each change immediately
+    void setUpdateWindow(int ms);
+    // full routing and service tables are advertised at this interval with
+    // jitter; zero disables periodic advertisements
+    void setRefreshInterval(int ms);
+    // routes are never advertised back to the channel they were learned from;
+    // with poison reverse they are advertised to it as unreachable instead.
+    // Peers that predate ROUTE_COST_INFINITY treat it as a very long route.
+    void setPoisonReverse(bool enabled);
+    // packets to a destination without a route are held for up to ms while the
+    // route is queried; zero fails such sends at once
+    void setPendingTimeout(int ms);
+    // local services advertise a load measured from their executors: one plus
+    // the ms a request would now wait and run for. A changed load is advertised
+    // at most once per interval; zero advertises a constant load of one.
+    void setLoadInterval(int ms);
+    // requests to service without a destination are also sent to a second
+    // instance when no response arrives within the percentile (0 to 1) of the
+    // service's recent response times. At most rate of the requests are hedged.
+    // The first instance to respond answers the request and responses from the
+    // other are dropped. A percentile of zero stops hedging.
+    void setHedging(QString service, double percentile = ROUTER_HEDGE_PERCENTILE,
+                    double rate = ROUTER_HEDGE_RATE);
+    // the single response to a request for service is kept for ttlMs, and
+    // requests with the same data are answered from it before request returns,
+    // whatever their destination. Only for idempotent services; zero stops
+    // caching and drops the responses held.
+    void setResponseCache(QString service, int ttlMs);
+    void setResponseCacheMemory(qint64 bytes);
+    ResponseCache::Stats responseCacheStats();
+    // service instances that time out repeatedly or answer requests much slower
+    // than the others are passed over by service selection for a back-off, then
+    // probed with one request at a time until one is answered; on by default
+    void setOutlierDetection(bool enabled);
 
     QMap<QString, QStringList> nodeServices();
+    // forwardingState returns the current forwarding state, rebuilding it first
+    // when the tables changed since it was published. Holders delay removeChannel
+    // and should let go of it soon.
+    std::shared_ptr<const ForwardingState> forwardingState();
 
 public slots:
     void onPacket(Channel*, Packet*);
     void onChannelClose(Channel*);
 
+private slots:
+    void publishState();
+    void onExpiryTick();
+    void flushUpdates();
+    void onRefreshTimer();
+    void onLoadTimer();
+    void onHedgeTimer();
+
 signals:
     void channelsChanged();
     void netStateChanged();
 
 private:
+    void invalidateState();
+    bool pruneRetiredStates();
+    void waitForSenders();
+    void pinHandler(INT16U ctx, PacketHandler* handler);
+    void unpinHandler(PacketHandler* handler);
+    void resetExpiry();
+    void updateTimer();
+    void queueRouteUpdate(QString address, short cost, INT16U seq, Channel* origin);
+    void withdrawRoute(RouteTable::Handle route, Channel* origin);
+    void scheduleRefresh();
+    void queueServiceUpdate(QString address, QString service, short load, INT16U seq, Channel* origin);
+    void queueLocalServiceUpdate(QString service, short load);
+    void resizeServicePool();
+    bool acceptResponse(RequestHandler* request, Packet* p);
+    // finishRequest ends the request, caching answer when it was the only
+    // response, and reports the instances asked to the outlier detector
+    void finishRequest(RequestHandler* request, Packet* answer = nullptr, bool timedOut = false);
+    void triggerUpdates();
     void handleNetState(Channel*, Packet*);
+    QString queuePending(Packet* p);
 
-    Packet* composeNetRouteShare(QString address, short cost);
+    Packet* composeNetRouteShare(QString address, short cost, INT16U seq = 0);
     RemoteNodeInfo parseNetRouteShare(Packet* packet);
-    Packet* composeNetServiceShare(QString address, QString service, short load);
+    Packet* composeNetServiceShare(QString address, QString service, short load, INT16U seq = 0);
     ServiceNodeInfo parseNetServiceShare(Packet* packet);
-    Packet* composeNetQuery();
+    Packet* composeNetQuery(QString address = QString());
+    QString parseNetQuery(Packet* packet);
 
-    QList<Packet*> exportRouteTable();
+    QList<Packet*> exportRouteTable(Channel* ch);
     QList<Packet*> exportServiceTable();
     void shareNetState();
 
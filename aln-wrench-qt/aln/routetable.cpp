@@ -0,0 +1,139 @@
+#include "routetable.h"
+
+#include <QHash>
+
+#define ROUTETABLE_MIN_INDEX 16
+
+RouteTable::RouteTable() {
+    clear();
+}
+
+// indexOf returns the index slot holding address, or the empty slot that ends its probe sequence
+int RouteTable::indexOf(const QString& address, uint hash) const {
+    int mask = mIndex.size() - 1;
+    int i = hash & mask;
+    while (mIndex[i] != NoRoute) {
+        const RouteEntry& e = mEntries[mIndex[i]];
+        if (e.hash == hash && e.address == address)
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+RouteTable::Handle RouteTable::find(const QString& address) const {
+    return mIndex[indexOf(address, qHash(address))];
+}
+
+RouteTable::Handle RouteTable::insert(const QString& address) {
+    uint hash = qHash(address);
+    int i = indexOf(address, hash);
+    if (mIndex[i] != NoRoute)
+        return mIndex[i];
+
+    // keep the index at most half full so probe sequences stay short
+    if ((mCount + 1) * 2 > mIndex.size()) {
+        grow();
+        i = indexOf(address, hash);
+    }
+
+    Handle h;
+    if (mFree.isEmpty()) {
+        h = mEntries.size();
+        mEntries.append(RouteEntry());
+    } else {
+        h = mFree.takeLast();
+    }
+    RouteEntry& e = mEntries[h];
+    e.address = address;
+    e.hash = hash;
+    e.used = true;
+    mIndex[i] = h;
+    mCount++;
+    return h;
+}
+
+bool RouteTable::remove(const QString& address) {
+    Handle h = find(address);
+    if (h == NoRoute)
+        return false;
+    remove(h);
+    return true;
+}
+
+void RouteTable::remove(Handle h) {
+    if (h < 0 || h >= mEntries.size() || !mEntries[h].used)
+        return;
+    int mask = mIndex.size() - 1;
+    int i = indexOf(mEntries[h].address, mEntries[h].hash);
+    mIndex[i] = NoRoute;
+
+    // shift later members of the probe run back so lookups need no tombstones
+    int j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (mIndex[j] == NoRoute)
+            break;
+        int home = mEntries[mIndex[j]].hash & mask;
+        bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!reachable) {
+            mIndex[i] = mIndex[j];
+            mIndex[j] = NoRoute;
+            i = j;
+        }
+    }
+
+    mEntries[h] = RouteEntry();
+    mFree.append(h);
+    mCount--;
+}
+
+void RouteTable::clear() {
+    mEntries.clear();
+    mEntries.squeeze();
+    mFree.clear();
+    mFree.squeeze();
+    mIndex.fill(NoRoute, ROUTETABLE_MIN_INDEX);
+    mIndex.squeeze();
+    mCount = 0;
+}
+
+void RouteTable::grow() {
+    QVector<Handle> index;
+    index.fill(NoRoute, mIndex.size() * 2);
+    int mask = index.size() - 1;
+    for (Handle h : mIndex) {
+        if (h == NoRoute)
+            continue;
+        int i = mEntries[h].hash & mask;
+        while (index[i] != NoRoute)
+            i = (i + 1) & mask;
+        index[i] = h;
+    }
+    mIndex = index;
+}
+
+QList<RouteTable::Handle> RouteTable::handles() const {
+    QList<Handle> list;
+    for (Handle h = 0; h < mEntries.size(); h++) {
+        if (mEntries[h].used)
+            list.append(h);
+    }
+    return list;
+}
+
+QStringList RouteTable::addresses() const {
+    QStringList list;
+    for (const RouteEntry& e : mEntries) {
+        if (e.used)
+            list.append(e.address);
+    }
+    return list;
+}
+
+qint64 RouteTable::memoryUsage() const {
+    return sizeof(RouteTable)
+        + (qint64)mEntries.capacity() * sizeof(RouteEntry)
+        + (qint64)mFree.capacity() * sizeof(Handle)
+        + (qint64)mIndex.capacity() * sizeof(Handle);
+}
@@ -0,0 +1,78 @@
+#ifndef ROUTETABLE_H
+#define ROUTETABLE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "channel.h"
+
+// RouteHop is a further next hop of a route at the route's cost
+class RouteHop {
+public:
+    QString nextHop;
+    Channel* channel = nullptr;
+    INT16U seq = 0; // sequence number last advertised through nextHop
+};
+
+// RouteEntry is a route to a remote node, stored inline in the RouteTable
+class RouteEntry {
+public:
+    QString address; // target address to communicate with
+    QString nextHop; // next routing node for address
+    Channel* channel = nullptr; // specific channel that is hosting next hop
+    short cost = 0; // cost of using this route, generally a hop count
+    INT16U seq = 0; // destination's sequence number, zero if unsequenced
+    qint64 lastSeen = 0; // router clock (ms) of the last advertisement from nextHop
+    // loop-free alternate: a neighbor other than nextHop whose own path does not
+    // lead back through this node, taken over at once if the channel to nextHop closes
+    QString altNextHop;
+    Channel* altChannel = nullptr; // nullptr when there is no alternate
+    short altCost = 0;
+    INT16U altSeq = 0;
+    // equal-cost multipath: other neighbors at the route's cost; traffic is
+    // spread by flow over nextHop and these
+    QVector<RouteHop> equalHops;
+    uint hash = 0; // cached qHash(address)
+    bool used = false;
+};
+
+// RouteTable maps addresses to routes with open addressing and linear probing.
+//
+// Entries live in a slab and are referred to by handles that stay valid until
+// the entry is removed; the probe index holds only handles, so growing the
+// index never moves an entry. Each entry caches its address hash so probes
+// compare strings only on a hash match. Removed entries are cleared and their
+// slots recycled through a free list.
+class RouteTable {
+public:
+    typedef int Handle;
+    static constexpr Handle NoRoute = -1;
+
+    RouteTable();
+
+    Handle find(const QString& address) const;
+    Handle insert(const QString& address); // finds or creates the entry for address
+    bool remove(const QString& address);
+    void remove(Handle);
+    void clear();
+
+    RouteEntry& at(Handle h) { return mEntries[h]; }
+    const RouteEntry& at(Handle h) const { return mEntries[h]; }
+    bool contains(const QString& address) const { return find(address) != NoRoute; }
+    int size() const { return mCount; }
+
+    QList<Handle> handles() const;
+    QStringList addresses() const;
+    qint64 memoryUsage() const; // bytes held by the table, excluding string contents
+
+private:
+    QVector<RouteEntry> mEntries;
+    QVector<Handle> mFree;
+    QVector<Handle> mIndex; // NoRoute marks an empty slot
+    int mCount;
+
+    int indexOf(const QString& address, uint hash) const;
+    void grow();
+};
+
+#endif // ROUTETABLE_H
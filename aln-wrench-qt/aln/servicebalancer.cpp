@@ -0,0 +1,56 @@
+#include "servicebalancer.h"
+
+int ServiceBalancer::choose(Policy policy, const QVector<short>& loads, const QVector<int>& outstanding,
+                            QRandomGenerator* random) {
+    int n = loads.size();
+    if (n == 0)
+        return -1;
+    // lower load wins; instances with equal loads compare by outstanding requests
+    auto better = [&](int a, int b) {
+        if (loads.at(a) != loads.at(b))
+            return loads.at(a) < loads.at(b);
+        return a < outstanding.size() && b < outstanding.size() && outstanding.at(a) < outstanding.at(b);
+    };
+
+    switch (policy) {
+    case LeastLoaded:
+    case Affinity:
+        break;
+    case PowerOfTwoChoices: {
+        if (n == 1)
+            return 0;
+        int a = random->bounded(n);
+        int b = random->bounded(n - 1);
+        if (b >= a)
+            b++; // two distinct instances
+        return better(b, a) ? b : a;
+    }
+    case WeightedRandom: {
+        double total = 0;
+        for (short load : loads)
+            total += 1.0 / qMax<short>(load, 1);
+        double r = random->generateDouble() * total;
+        for (int i = 0; i < n; i++) {
+            r -= 1.0 / qMax<short>(loads.at(i), 1);
+            if (r < 0)
+                return i;
+        }
+        return n - 1;
+    }
+    case LeastOutstanding: {
+        int best = 0;
+        for (int i = 1; i < n && i < outstanding.size(); i++) {
+            if (outstanding.at(i) < outstanding.at(best) || (outstanding.at(i) == outstanding.at(best) && better(i, best)))
+                best = i;
+        }
+        return best;
+    }
+    }
+
+    int best = 0;
+    for (int i = 1; i < n; i++) {
+        if (better(i, best))
+            best = i;
+    }
+    return best;
+}
@@ -0,0 +1,33 @@
+#ifndef SERVICEBALANCER_H
+#define SERVICEBALANCER_H
+
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QVector>
+
+// ServiceBalancer chooses which remote instance of a service a request goes to.
+//
+// Advertised loads are seconds old by the time they are read, so sending
+// every request to the least loaded instance herds them onto one host until
+// its next advertisement. The randomized policies spread requests while still
+// favoring lightly loaded hosts.
+class ServiceBalancer {
+public:
+    enum Policy {
+        LeastLoaded, // the lowest advertised load
+        PowerOfTwoChoices, // the lower load of two instances picked at random
+        WeightedRandom, // random, weighted by the inverse of the advertised load
+        LeastOutstanding, // the fewest requests from this node awaiting a response
+        Affinity // the host a HashRing assigns the request's key; the router applies it
+    };
+
+    // choose returns the index of the chosen instance, or -1 when there is none.
+    // loads holds each instance's advertised load and outstanding its requests
+    // in flight from this node; outstanding may be empty for policies that do
+    // not use it, and ties fall to the lower load. Affinity needs a key, so
+    // here it chooses as LeastLoaded.
+    static int choose(Policy policy, const QVector<short>& loads, const QVector<int>& outstanding,
+                      QRandomGenerator* random = QRandomGenerator::global());
+};
+
+#endif // SERVICEBALANCER_H
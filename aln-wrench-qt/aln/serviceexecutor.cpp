@@ -0,0 +1,153 @@
+#include "serviceexecutor.h"
+#include "router.h"
+
+// ServiceWorker runs waiting flows of an executor until none is left; it holds
+// the executor so an unregistered service outlives its last handler call
+class ServiceWorker : public QRunnable {
+    std::shared_ptr<ServiceExecutor> executor;
+public:
+    explicit ServiceWorker(std::shared_ptr<ServiceExecutor> e) : executor(e) {}
+    void run() { executor->drain(); }
+};
+
+ServiceExecutor::ServiceExecutor(QString service, PacketHandler* handler, QThreadPool* pool,
+                                 int workers, int queueLimit, Overflow overflow)
+    : mService(service), mHandler(handler), mPool(pool), mWorkers(qMax(workers, 0)),
+      mQueueLimit(qMax(queueLimit, 1)), mOverflow(overflow) {
+    mClock.start();
+}
+
+ServiceExecutor::~ServiceExecutor() {
+    for (const QQueue<Packet*>& queue : mFlows) {
+        for (Packet* p : queue)
+            delete p;
+    }
+}
+
+QString ServiceExecutor::post(Packet* packet) {
+    QMutexLocker lock(&mMutex);
+    if (mClosed) {
+        delete packet;
+        return QString("service '%1' not registered\n").arg(mService);
+    }
+    if (mWorkers == 0) {
+        mRunning++;
+        lock.unlock();
+        call(packet);
+        lock.relock();
+        if (--mRunning == 0)
+            mIdle.wakeAll();
+        return QString();
+    }
+
+    if (mQueued >= mQueueLimit) {
+        if (mOverflow == Reject) {
+            mDropped++;
+            delete packet;
+            return QString("service '%1' busy; packet refused").arg(mService);
+        }
+        // the longest waiting flow, or else a running flow with packets waiting
+        auto victim = mFlows.end();
+        if (!mReady.isEmpty()) {
+            victim = mFlows.find(mReady.head());
+        } else {
+            for (victim = mFlows.begin(); victim.value().isEmpty(); ++victim) {}
+        }
+        delete victim.value().dequeue();
+        mQueued--;
+        mDropped++;
+        if (victim.value().isEmpty() && !mReady.isEmpty() && mReady.head() == victim.key()) {
+            mReady.dequeue();
+            mFlows.erase(victim);
+        }
+    }
+
+    Flow flow(packet->srcAddress, packet->ctx);
+    auto it = mFlows.find(flow);
+    if (it == mFlows.end()) {
+        it = mFlows.insert(flow, QQueue<Packet*>());
+        mReady.enqueue(flow);
+    } // else the flow is waiting or running, and stays where it is
+    it.value().enqueue(packet);
+    mQueued++;
+    if (mRunning < mWorkers && mRunning < mReady.size()) {
+        mRunning++;
+        mPool->start(new ServiceWorker(shared_from_this()));
+    }
+    return QString();
+}
+
+// drain runs one packet at a time from the longest waiting flow; a flow with
+// more packets goes to the back of the line
+void ServiceExecutor::drain() {
+    QMutexLocker lock(&mMutex);
+    while (!mReady.isEmpty()) {
+        Flow flow = mReady.dequeue();
+        Packet* packet = mFlows[flow].dequeue();
+        mQueued--;
+        lock.unlock();
+        call(packet);
+        lock.relock();
+        auto it = mFlows.find(flow);
+        if (it == mFlows.end())
+            continue; // discarded by shutdown
+        if (it.value().isEmpty())
+            mFlows.erase(it);
+        else
+            mReady.enqueue(flow);
+    }
+    if (--mRunning == 0)
+        mIdle.wakeAll();
+}
+
+// the weight of the newest call in the latency average
+#define EXECUTOR_LATENCY_WEIGHT 0.125
+
+void ServiceExecutor::call(Packet* packet) {
+    qint64 start = mClock.nsecsElapsed();
+    mHandler->onPacket(packet);
+    delete packet;
+    double ms = (mClock.nsecsElapsed() - start) / 1e6;
+    QMutexLocker lock(&mMutex);
+    mLatency = mMeasured ? mLatency + EXECUTOR_LATENCY_WEIGHT * (ms - mLatency) : ms;
+    mMeasured = true;
+}
+
+void ServiceExecutor::shutdown() {
+    QMutexLocker lock(&mMutex);
+    mClosed = true;
+    for (const QQueue<Packet*>& queue : mFlows) {
+        for (Packet* p : queue)
+            delete p;
+    }
+    mFlows.clear();
+    mReady.clear();
+    mQueued = 0;
+    while (mRunning > 0)
+        mIdle.wait(&mMutex);
+}
+
+int ServiceExecutor::queued() {
+    QMutexLocker lock(&mMutex);
+    return mQueued;
+}
+
+int ServiceExecutor::running() {
+    QMutexLocker lock(&mMutex);
+    return mRunning;
+}
+
+double ServiceExecutor::latency() {
+    QMutexLocker lock(&mMutex);
+    return mLatency;
+}
+
+double ServiceExecutor::expectedDelay() {
+    QMutexLocker lock(&mMutex);
+    return mLatency * (mQueued + mRunning + 1) / qMax(mWorkers, 1);
+}
+
+qint64 ServiceExecutor::dropped() {
+    QMutexLocker lock(&mMutex);
+    return mDropped;
+}
@@ -0,0 +1,85 @@
+#ifndef SERVICEEXECUTOR_H
+#define SERVICEEXECUTOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <memory>
+#include "alntypes.h"
+
+class Packet;
+class PacketHandler;
+
+// ServiceExecutor delivers the packets for one local service to its handler
+// on worker threads of a shared pool, so a slow handler holds up neither the
+// router nor other services.
+//
+// Packets are grouped into flows by (source address, context). A flow is run
+// by one worker at a time, in arrival order; separate flows run on up to
+// `workers` threads at once and take turns, so one busy flow cannot hold every
+// worker. At most `queueLimit` packets wait; beyond that a packet is refused or
+// the oldest packet of the longest waiting flow is dropped to make room.
+//
+// With zero workers the handler runs on the sending thread, as a direct call.
+class ServiceExecutor : public std::enable_shared_from_this<ServiceExecutor> {
+public:
+    enum Overflow {
+        Reject, // refuse the new packet
+        DropOldest // drop the head of the longest waiting flow
+    };
+
+    ServiceExecutor(QString service, PacketHandler* handler, QThreadPool* pool,
+                    int workers, int queueLimit, Overflow overflow);
+    ~ServiceExecutor();
+
+    // post takes ownership of packet and queues it for the handler; returns an
+    // error when the packet is refused
+    QString post(Packet* packet);
+    // shutdown refuses further packets, discards the waiting ones and returns
+    // once no handler call is running; it must not be called from the handler
+    void shutdown();
+
+    PacketHandler* handler() const { return mHandler; }
+    int workers() const { return mWorkers; }
+    int queued();
+    int running();
+    qint64 dropped();
+    // latency is the moving average of the handler's call duration in ms
+    double latency();
+    // expectedDelay estimates the ms a packet posted now waits and runs for:
+    // the average latency times the calls queued, running and new, per worker
+    double expectedDelay();
+
+private:
+    typedef QPair<QString, INT16U> Flow;
+    friend class ServiceWorker;
+
+    QString mService;
+    PacketHandler* mHandler;
+    QThreadPool* mPool;
+    int mWorkers;
+    int mQueueLimit;
+    Overflow mOverflow;
+
+    QMutex mMutex;
+    QWaitCondition mIdle;
+    QHash<Flow, QQueue<Packet*>> mFlows; // waiting packets; a running flow keeps its entry
+    QQueue<Flow> mReady; // flows with waiting packets and no running worker, longest waiting first
+    int mQueued = 0;
+    int mRunning = 0;
+    qint64 mDropped = 0;
+    bool mClosed = false;
+    QElapsedTimer mClock;
+    double mLatency = 0;
+    bool mMeasured = false;
+
+    void drain();
+    void call(Packet* packet); // runs the handler on packet and measures it; called unlocked
+};
+
+#endif // SERVICEEXECUTOR_H
@@ -0,0 +1,99 @@
+#include "servicetable.h"
+
+bool ServiceTable::update(const QString& service, const QString& address, INT16U load, qint64 now, INT16U seq) {
+    if (load == 0)
+        return remove(service, address);
+
+    ServiceInstances& instances = mServices[service];
+    auto it = instances.loadOf.find(address);
+    if (it != instances.loadOf.end()) {
+        if (it.value() == load) {
+            NodeCapacity& capacity = instances.byLoad[ServiceInstances::LoadKey(load, address)];
+            capacity.lastSeen = now;
+            capacity.seq = seq;
+            return false;
+        }
+        // move the host to its new position in the load order
+        instances.byLoad.remove(ServiceInstances::LoadKey(it.value(), address));
+        it.value() = load;
+    } else {
+        instances.loadOf.insert(address, load);
+        mServicesOf[address].insert(service);
+    }
+
+    NodeCapacity capacity;
+    capacity.capacity = load;
+    capacity.lastSeen = now;
+    capacity.seq = seq;
+    instances.byLoad.insert(ServiceInstances::LoadKey(load, address), capacity);
+    return true;
+}
+
+bool ServiceTable::remove(const QString& service, const QString& address) {
+    auto sit = mServices.find(service);
+    if (sit == mServices.end())
+        return false;
+    ServiceInstances& instances = sit.value();
+    auto it = instances.loadOf.find(address);
+    if (it == instances.loadOf.end())
+        return false;
+    instances.byLoad.remove(ServiceInstances::LoadKey(it.value(), address));
+    instances.loadOf.erase(it);
+    if (instances.loadOf.isEmpty())
+        mServices.erase(sit);
+
+    auto hosted = mServicesOf.find(address);
+    hosted.value().remove(service);
+    if (hosted.value().isEmpty())
+        mServicesOf.erase(hosted);
+    return true;
+}
+
+void ServiceTable::removeAddress(const QString& address) {
+    foreach (QString service, mServicesOf.value(address))
+        remove(service, address);
+}
+
+const ServiceInstances* ServiceTable::find(const QString& service) const {
+    auto it = mServices.constFind(service);
+    if (it == mServices.constEnd())
+        return nullptr;
+    return &it.value();
+}
+
+const NodeCapacity* ServiceTable::find(const QString& service, const QString& address) const {
+    const ServiceInstances* instances = find(service);
+    if (!instances)
+        return nullptr;
+    auto load = instances->loadOf.constFind(address);
+    if (load == instances->loadOf.constEnd())
+        return nullptr;
+    return &instances->byLoad.find(ServiceInstances::LoadKey(load.value(), address)).value();
+}
+
+QString ServiceTable::leastLoaded(const QString& service) const {
+    const ServiceInstances* instances = find(service);
+    if (!instances || instances->byLoad.isEmpty())
+        return QString();
+    return instances->byLoad.firstKey().second;
+}
+
+QVector<short> ServiceTable::loads(const QString& service) const {
+    QVector<short> list;
+    const ServiceInstances* instances = find(service);
+    if (instances) {
+        for (auto it = instances->byLoad.constBegin(); it != instances->byLoad.constEnd(); ++it)
+            list.append(it.value().capacity);
+    }
+    return list;
+}
+
+QStringList ServiceTable::addresses(const QString& service) const {
+    QStringList list;
+    const ServiceInstances* instances = find(service);
+    if (instances) {
+        for (auto it = instances->byLoad.constBegin(); it != instances->byLoad.constEnd(); ++it)
+            list.append(it.key().second);
+    }
+    return list;
+}
@@ -0,0 +1,56 @@
+#ifndef SERVICETABLE_H
+#define SERVICETABLE_H
+
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "alntypes.h"
+
+class NodeCapacity {
+public:
+    short capacity;
+    qint64 lastSeen; // router clock (ms) of the last advertisement
+    INT16U seq; // host's version of the advertisement; zero when unversioned
+};
+
+// ServiceInstances holds the remote hosts of one service. Hosts are ordered by
+// their advertised load so the least loaded host is always the first entry;
+// loadOf finds a host's current position in that order.
+class ServiceInstances {
+public:
+    typedef QPair<INT16U, QString> LoadKey; // (load, address)
+
+    QMap<LoadKey, NodeCapacity> byLoad;
+    QHash<QString, INT16U> loadOf;
+};
+
+// ServiceTable maps service names to the remote hosts advertising them
+class ServiceTable {
+public:
+    // update records the load advertised by address at now under version seq;
+    // a load of zero removes the host. Returns false when the advertisement
+    // changes nothing beyond refreshing the host's last-seen time and version.
+    bool update(const QString& service, const QString& address, INT16U load, qint64 now = 0, INT16U seq = 0);
+    bool remove(const QString& service, const QString& address);
+    void removeAddress(const QString& address); // costs the number of services address hosts
+    void clear() { mServices.clear(); mServicesOf.clear(); }
+
+    bool contains(const QString& service) const { return mServices.contains(service); }
+    const ServiceInstances* find(const QString& service) const; // nullptr if no host offers service
+    const NodeCapacity* find(const QString& service, const QString& address) const;
+    QString leastLoaded(const QString& service) const;
+    QStringList addresses(const QString& service) const; // ordered by load
+    QVector<short> loads(const QString& service) const; // in the order of addresses
+    QStringList services() const { return mServices.keys(); }
+    QStringList services(const QString& address) const { return mServicesOf.value(address).values(); }
+
+private:
+    QHash<QString, ServiceInstances> mServices;
+    QHash<QString, QSet<QString>> mServicesOf; // address -> services it hosts
+};
+
+#endif // SERVICETABLE_H
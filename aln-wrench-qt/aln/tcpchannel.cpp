@@ -32,6 +32,16 @@ QString TcpChannel::peerName() {
 }
 
 bool TcpChannel::send(Packet* p) {
+    if (QThread::currentThread() != thread()) {
+        // the socket may only be used from the channel's thread; pooled service
+        // handlers reply from their workers, so their packets are handed over
+        QMutexLocker lock(&writeMutex);
+        if (writeQueue.isEmpty())
+            QMetaObject::invokeMethod(this, "onWriteQueued", Qt::QueuedConnection);
+        writeQueue.append(p);
+        return true;
+    }
+
     if (!socket->isOpen()) {
         packetQueue.append(p);
         err = "Socket not open; packet queued";
@@ -59,6 +69,17 @@ void TcpChannel::onConnected() {
     packetQueue.clear();
 }
 
+void TcpChannel::onWriteQueued() {
+    QList<Packet*> packets;
+    {
+        QMutexLocker lock(&writeMutex);
+        packets.swap(writeQueue);
+    }
+    foreach(Packet* p, packets) {
+        send(p);
+    }
+}
+
 bool TcpChannel::listen() {
     if (!socket-> isOpen()) {
         err = "Socket read error: socket is not open";
@@ -3,6 +3,7 @@
 
 #include "channel.h"
 #include "parser.h"
+#include <QMutex>
 #include <QTcpSocket>
 
 
@@ -13,6 +14,9 @@ private:
     QTcpSocket* socket;
     QString err;
     QList<Packet*> packetQueue;
+    // packets sent from threads other than the channel's, waiting for its thread
+    QMutex writeMutex;
+    QList<Packet*> writeQueue;
 
 public:
     TcpChannel(QTcpSocket*, QObject* = 0);
@@ -31,6 +35,7 @@ private slots:
     void onPacketParsed(Packet*);
     void onConnected();
     void onSocketError(QAbstractSocket::SocketError);
+    void onWriteQueued();
 };
 
 #endif // TCPCHANNEL_H
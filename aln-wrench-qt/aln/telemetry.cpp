@@ -0,0 +1,33 @@
+#include "telemetry.h"
+
+TelemetryBatch parseTelemetry(QByteArray data) {
+    TelemetryBatch batch;
+    if (data.length() < TELEMETRY_HEADER_SIZE) {
+        batch.err = QString("parseTelemetry: len: %1; min: %2").arg(data.length()).arg(TELEMETRY_HEADER_SIZE);
+        return batch;
+    }
+    if ((data.length() - TELEMETRY_HEADER_SIZE) % TELEMETRY_SAMPLE_SIZE != 0) {
+        batch.err = QString("parseTelemetry: truncated sample; len: %1").arg(data.length());
+        return batch;
+    }
+
+    INT08U* pData = (INT08U*)data.data();
+    if (pData[0] != TELEMETRY_VERSION) {
+        batch.err = QString("parseTelemetry: unsupported version %1").arg(pData[0]);
+        return batch;
+    }
+    double scale = 1;
+    for (int i = 0; i < pData[1]; i++)
+        scale *= 10;
+    INT16U tickMs = readINT16U(pData + 2);
+    INT32U timestamp = readINT32U(pData + 4);
+    qint32 value = (qint16)readINT16U(pData + 8);
+    batch.samples.append(TelemetrySample{timestamp, value / scale});
+
+    for (int offset = TELEMETRY_HEADER_SIZE; offset < data.length(); offset += TELEMETRY_SAMPLE_SIZE) {
+        timestamp += pData[offset] * tickMs;
+        value += (qint8)pData[offset + 1];
+        batch.samples.append(TelemetrySample{timestamp, value / scale});
+    }
+    return batch;
+}
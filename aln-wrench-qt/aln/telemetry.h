@@ -0,0 +1,31 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "alntypes.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+// Packet data type of a telemetry batch, as produced by the Arduino
+// TelemetryBatch: a fixed header followed by (tick delta, value delta) pairs.
+#define TELEMETRY_DATATYPE 0x54
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HEADER_SIZE 10
+#define TELEMETRY_SAMPLE_SIZE 2
+
+class TelemetrySample {
+public:
+    INT32U timestamp; // sender's millis() clock
+    double value;
+};
+
+class TelemetryBatch {
+public:
+    QList<TelemetrySample> samples;
+    QString err;
+};
+
+TelemetryBatch parseTelemetry(QByteArray data);
+
+#endif // TELEMETRY_H
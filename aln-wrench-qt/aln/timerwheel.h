@@ -0,0 +1,98 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QList>
+#include <QVector>
+#include <QtGlobal>
+
+// TimerWheel is a hierarchical timing wheel holding deadlines in milliseconds of
+// a monotonic clock. Each level has 64 slots; a slot of level L spans 64^L ticks,
+// so four levels cover 64^4 ticks (about 19 days at 100 ms). Scheduling and
+// expiry cost O(1) per timer; a timer is moved to a finer level at most once per
+// level on its way down.
+//
+// Timers cannot be cancelled. Owners validate a fired value against their own
+// state (e.g. a last-seen time or a generation) and reschedule when still live.
+template <typename T>
+class TimerWheel {
+public:
+    explicit TimerWheel(qint64 tickMs = 100, qint64 now = 0)
+        : mTickMs(tickMs > 0 ? tickMs : 1), mTick(now / mTickMs), mCount(0) {}
+
+    void schedule(qint64 deadline, const T& value) {
+        Timer t;
+        t.tick = (deadline + mTickMs - 1) / mTickMs;
+        t.value = value;
+        place(t);
+        mCount++;
+    }
+
+    // advance moves the wheel to now and returns the values whose deadline has passed
+    QList<T> advance(qint64 now) {
+        QList<T> expired;
+        qint64 target = now / mTickMs;
+        while (mTick <= target) {
+            if (mCount == 0) {
+                mTick = target + 1;
+                break;
+            }
+            cascade();
+            QVector<Timer> slot;
+            slot.swap(mSlots[0][mTick & SlotMask]);
+            for (const Timer& t : slot) {
+                if (t.tick <= mTick) {
+                    expired.append(t.value);
+                    mCount--;
+                } else {
+                    place(t); // clamped beyond the top level's range
+                }
+            }
+            mTick++;
+        }
+        return expired;
+    }
+
+    int size() const { return mCount; }
+    qint64 tickMs() const { return mTickMs; }
+
+private:
+    static const int Levels = 4;
+    static const int SlotBits = 6;
+    static const int Slots = 1 << SlotBits;
+    static const int SlotMask = Slots - 1;
+
+    struct Timer {
+        qint64 tick;
+        T value;
+    };
+
+    qint64 mTickMs;
+    qint64 mTick; // next tick to be processed
+    int mCount;
+    QVector<Timer> mSlots[Levels][Slots];
+
+    void place(const Timer& t) {
+        qint64 tick = qMax(t.tick, mTick);
+        qint64 delta = tick - mTick;
+        int level = 0;
+        while (level < Levels - 1 && (delta >> (SlotBits * (level + 1))) != 0)
+            level++;
+        if (level == Levels - 1 && (delta >> (SlotBits * Levels)) != 0)
+            tick = mTick + ((qint64)1 << (SlotBits * Levels)) - 1;
+        mSlots[level][(tick >> (SlotBits * level)) & SlotMask].append(t);
+    }
+
+    // cascade redistributes the coarser slots that begin at the current tick
+    void cascade() {
+        for (int level = 1; level < Levels; level++) {
+            if ((mTick & (((qint64)1 << (SlotBits * level)) - 1)) != 0)
+                break;
+            QVector<Timer> slot;
+            slot.swap(mSlots[level][(mTick >> (SlotBits * level)) & SlotMask]);
+            for (const Timer& t : slot)
+                place(t);
+        }
+    }
+};
+
+#endif // TIMERWHEEL_H
@@ -4,6 +4,7 @@
 #include "ui_mainwindow.h"
 
 #include "aln/packet.h"
+#include "aln/telemetry.h"
 #include <aln/localchannel.h>
 
 #include <QDateTime>
@@ -24,11 +25,13 @@ public:
     }
 };
 
+// PacketSignaler hands a copy of each packet to the slots connected to it;
+// the slot owns the copy, since the router deletes the packet on return
 class PacketSignaler: public PacketHandler {
 public:
     PacketSignaler() { }
     void onPacket(Packet *packet) {
-        emit packetReceived(packet);
+        emit packetReceived(packet->copy());
     }
 };
 
@@ -54,12 +57,14 @@ void MainWindow::init() {
 
     alnRouter = new Router();
     PacketSignaler* logSignaler = new PacketSignaler();
-    connect(logSignaler, SIGNAL(packetReceived(Packet*)), this, SLOT(logServicePacketHandler(Packet*)));
+    // service handlers run on the router's worker threads, which go on to the
+    // next packet while the window handles its copy of this one
+    connect(logSignaler, SIGNAL(packetReceived(Packet*)), this, SLOT(logServicePacketHandler(Packet*)), Qt::QueuedConnection);
     alnRouter->registerService("log", logSignaler);
     connect(ui->clearLogButton, SIGNAL(clicked()), this, SLOT(clearLog()));
 
     PacketSignaler* echoSignaler = new PacketSignaler();
-    connect(echoSignaler, SIGNAL(packetReceived(Packet*)), this, SLOT(echoServicePacketHandler(Packet*)));
+    connect(echoSignaler, SIGNAL(packetReceived(Packet*)), this, SLOT(echoServicePacketHandler(Packet*)), Qt::QueuedConnection);
     alnRouter->registerService("echo", echoSignaler );
 
     connect(alnRouter, SIGNAL(netStateChanged()),
@@ -115,23 +120,37 @@ void MainWindow::init() {
 }
 
 void MainWindow::logServicePacketHandler(Packet* packet) {
+    if (packet->type == TELEMETRY_DATATYPE) {
+        TelemetryBatch batch = parseTelemetry(packet->data);
+        if (batch.err.length() > 0) {
+            qDebug() << batch.err;
+        }
+        foreach (TelemetrySample sample, batch.samples) {
+            logServiceBufferList.append(QString("%0 - t:%1 %2").arg(packet->srcAddress).arg(sample.timestamp).arg(sample.value));
+        }
+    } else {
+        logServiceBufferList.append(QString("%0 - %1").arg(packet->srcAddress).arg(packet->data));
+    }
+    delete packet;
     while (logServiceBufferList.size() > 20)
         logServiceBufferList.removeFirst();
-    logServiceBufferList.append(QString("%0 - %1").arg(packet->srcAddress).arg(packet->data));
     ui->logServiceListView->setModel(new QStringListModel(logServiceBufferList));
 }
 
 void MainWindow::echoServicePacketHandler(Packet* packet) {
     if (packet->srcAddress.length() == 0) {
         qWarning() << "echo service cannot respond to an empty address";
+        delete packet;
         return;
     }
     if (packet->ctx == 0) {
         qWarning() << "echo service cannot respond to null context (context id is zero)";
+        delete packet;
         return;
     }
     qDebug() << "echo service returning " << packet->data << " to " << packet->srcAddress << ":" << packet->ctx;
     alnRouter->send(new Packet(packet->srcAddress, packet->ctx, packet->data));
+    delete packet;
 }
 
 void MainWindow::addLogLine(QString msg) {
@@ -3,24 +3,15 @@
 #include <QGroupBox>
 #include <QHBoxLayout>
 #include <QLabel>
-
 #include <QPushButton>
 
-class ResponseHandler : public PacketHandler {
-    PacketSendDialog* sendDialog;
-public:
-    ResponseHandler(PacketSendDialog* dlg) : sendDialog(dlg) {}
-    void onPacket(Packet* p) {
-        sendDialog->setResponse(p->data);
-    }
-};
+// responses to a sent packet are collected for this long
+#define RESPONSE_TIMEOUT_MS 10000
 
 PacketSendDialog::PacketSendDialog(Router* alnRouter, QWidget *parent, Qt::WindowFlags flags)
     : QDialog(parent, flags), router(alnRouter) {
     setWindowTitle("Send Packet");
-    contextID = alnRouter->registerContextHandler(new ResponseHandler(this));
     setLayout(createLayout());
-    connect(this, SIGNAL(finished(int)), SLOT(onClose()));
 }
 
 void PacketSendDialog::setDest(QString destAddress) {
@@ -39,17 +30,19 @@ void PacketSendDialog::setResponse(QString resp) {
     responseLabel->setText(resp);
 }
 
-void PacketSendDialog::onClose() {
-    router->releaseContext(contextID);
-}
-
 void PacketSendDialog::onSendClicked() {
     QString dst = destLineEdit->text();
     QString srv = serviceLineEdit->text();
     QString data = dataLineEdit->text();
-    Packet* packet = new Packet(dst, srv, contextID, data.toUtf8());
     qDebug() << "Sending packet:" << data << "to: " << dst;
-    router->send(packet);
+    // the request ends early if the dialog is closed and destroyed
+    QString err = router->request(dst, srv, data.toUtf8(), RESPONSE_TIMEOUT_MS, this, [this](Packet* p) {
+        setResponse(p->data);
+        return true; // show each response until the timeout
+    });
+    if (err.length() > 0) {
+        setResponse(err);
+    }
 }
 
 void PacketSendDialog::onCloseClicked() {
@@ -67,11 +60,6 @@ QLayout* PacketSendDialog::createLayout() {
     serviceLayout->addWidget(new QLabel("srv"));
     serviceLayout->addWidget(serviceLineEdit);
 
-    QHBoxLayout* contextLayout = new QHBoxLayout;
-    contextLayout->addWidget(new QLabel("ctx"));
-    contextLayout->addWidget(new QLabel(QString("%1").arg(contextID)));
-    contextLayout->addStretch();
-
     QHBoxLayout* dataLayout = new QHBoxLayout;
     dataLineEdit = new QLineEdit;
     dataLayout->addWidget(new QLabel("data"));
@@ -98,7 +86,6 @@ QLayout* PacketSendDialog::createLayout() {
     QVBoxLayout* layout = new QVBoxLayout;
     layout->addLayout(destLayout);
     layout->addLayout(serviceLayout);
-    layout->addLayout(contextLayout);
     layout->addLayout(dataLayout);
     layout->addWidget(responseGroupBox);
     layout->addLayout(buttonLayout);
@@ -12,7 +12,6 @@ class PacketSendDialog : public QDialog
     Q_OBJECT
 
     Router* router;
-    unsigned short contextID;
     QString response;
 
     QLineEdit* destLineEdit;
@@ -31,7 +30,6 @@ public:
 public slots:
     void onSendClicked();
     void onCloseClicked();
-    void onClose();
 
 protected:
     QLayout* createLayout();
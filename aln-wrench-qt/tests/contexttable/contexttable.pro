@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_contexttable
+
+SOURCES += \
+    $$ALN/contexttable.cpp \
+    tst_contexttable.cpp
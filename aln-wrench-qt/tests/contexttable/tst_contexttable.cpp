@@ -0,0 +1,138 @@
+#include <QtTest>
+#include "contexttable.h"
+
+// the table only stores handlers, so tests tell them apart by address
+static PacketHandler* const handlerA = reinterpret_cast<PacketHandler*>(0x10);
+static PacketHandler* const handlerB = reinterpret_cast<PacketHandler*>(0x20);
+
+class TestContextTable : public QObject {
+    Q_OBJECT
+
+private slots:
+    void acquireAndRelease();
+    void releasedIdIsQuarantined();
+    void releasedIdsReissuedOldestFirst();
+    void exhaustedTable();
+    void deadlineExpires();
+    void releasedContextDoesNotExpire();
+    void churn_data();
+    void churn();
+    void expireMany();
+};
+
+void TestContextTable::acquireAndRelease() {
+    ContextTable table;
+    INT16U a = table.acquire(handlerA, 0, 0);
+    INT16U b = table.acquire(handlerB, 0, 0);
+    QVERIFY(a != 0 && b != 0 && a != b);
+    QCOMPARE(table.size(), 2);
+    QVERIFY(table.contains(a));
+    QCOMPARE(table.handler(b), handlerB);
+    QVERIFY(table.release(a, 0));
+    QVERIFY(!table.release(a, 0));
+    QVERIFY(!table.release(0, 0));
+    QVERIFY(!table.contains(a));
+    QCOMPARE(table.handler(a), (PacketHandler*)nullptr);
+    QCOMPARE(table.size(), 1);
+}
+
+void TestContextTable::releasedIdIsQuarantined() {
+    ContextTable table;
+    INT16U a = table.acquire(handlerA, 0, 0);
+    table.release(a, 100);
+    QVERIFY(table.acquire(handlerB, 0, 100 + CONTEXT_QUARANTINE_MS - 1) != a);
+    QCOMPARE(table.acquire(handlerB, 0, 100 + CONTEXT_QUARANTINE_MS), a);
+}
+
+void TestContextTable::releasedIdsReissuedOldestFirst() {
+    ContextTable table;
+    INT16U a = table.acquire(handlerA, 0, 0);
+    INT16U b = table.acquire(handlerA, 0, 0);
+    table.release(b, 0);
+    table.release(a, 10);
+    qint64 later = 10 + CONTEXT_QUARANTINE_MS;
+    QCOMPARE(table.acquire(handlerB, 0, later), b);
+    QCOMPARE(table.acquire(handlerB, 0, later), a);
+}
+
+// exhaustedTable fills every id; a released id is then reissued at once
+// despite its quarantine
+void TestContextTable::exhaustedTable() {
+    ContextTable table;
+    for (int i = 0; i < CONTEXT_MAX_ID; i++)
+        QVERIFY(table.acquire(handlerA, 0, 0) != 0);
+    QCOMPARE(table.acquire(handlerA, 0, 0), (INT16U)0);
+    table.release(42, 0);
+    QCOMPARE(table.acquire(handlerB, 0, 1), (INT16U)42);
+    QCOMPARE(table.size(), CONTEXT_MAX_ID);
+}
+
+void TestContextTable::deadlineExpires() {
+    ContextTable table;
+    INT16U a = table.acquire(handlerA, 500, 0);
+    INT16U b = table.acquire(handlerB, 0, 0);
+    QVERIFY(table.expire(499).isEmpty());
+    QList<ContextTable::Context> expired = table.expire(500);
+    QCOMPARE(expired.size(), 1);
+    QCOMPARE(expired.first().first, a);
+    QCOMPARE(expired.first().second, handlerA);
+    QVERIFY(!table.contains(a));
+    QVERIFY(table.contains(b));
+}
+
+// releasedContextDoesNotExpire checks that a deadline set for a released id
+// leaves the id's next holder alone
+void TestContextTable::releasedContextDoesNotExpire() {
+    ContextTable table;
+    INT16U a = table.acquire(handlerA, CONTEXT_QUARANTINE_MS + 500, 0);
+    table.release(a, 0);
+    QCOMPARE(table.acquire(handlerB, 0, CONTEXT_QUARANTINE_MS), a);
+    QVERIFY(table.expire(CONTEXT_QUARANTINE_MS + 1000).isEmpty());
+    QVERIFY(table.contains(a));
+}
+
+void TestContextTable::churn_data() {
+    QTest::addColumn<int>("outstanding");
+    QTest::newRow("100") << 100;
+    QTest::newRow("10k") << 10000;
+}
+
+// churn acquires and releases contexts with outstanding requests open, one
+// ms apart, as a busy client does
+void TestContextTable::churn() {
+    QFETCH(int, outstanding);
+    ContextTable table;
+    QVector<INT16U> open;
+    qint64 now = 0;
+    for (int i = 0; i < outstanding; i++)
+        open.append(table.acquire(handlerA, 0, now));
+    int next = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 10000; i++) {
+            now++;
+            table.release(open.at(next), now);
+            open[next] = table.acquire(handlerA, 0, now);
+            next = (next + 1) % outstanding;
+        }
+    }
+    QCOMPARE(table.size(), outstanding);
+    QVERIFY(!open.contains(0));
+}
+
+// expireMany lets 10k contexts with deadlines spread over a second time out
+void TestContextTable::expireMany() {
+    int expired = 0;
+    QBENCHMARK {
+        ContextTable table;
+        for (int i = 0; i < 10000; i++)
+            table.acquire(handlerA, 1 + i % 1000, 0);
+        expired = 0;
+        for (qint64 now = 0; now <= 1000; now += 50)
+            expired += table.expire(now).size();
+    }
+    QCOMPARE(expired, 10000);
+}
+
+QTEST_APPLESS_MAIN(TestContextTable)
+
+#include "tst_contexttable.moc"
@@ -0,0 +1,9 @@
+include(../tests.pri)
+
+TARGET = tst_floodfilter
+
+SOURCES += \
+    $$ALN/alntypes.cpp \
+    $$ALN/floodfilter.cpp \
+    $$ALN/packet.cpp \
+    tst_floodfilter.cpp
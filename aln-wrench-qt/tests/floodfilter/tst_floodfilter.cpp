@@ -0,0 +1,128 @@
+#include <QtTest>
+#include "floodfilter.h"
+#include "packet.h"
+
+class TestFloodFilter : public QObject {
+    Q_OBJECT
+
+private slots:
+    void seenOnce();
+    void rememberedForAWindow();
+    void idleFilterForgets();
+    void capacityRotates();
+    void forget();
+    void fingerprintIgnoresPath();
+    void seenRate_data();
+    void seenRate();
+    void fingerprintRate();
+};
+
+void TestFloodFilter::seenOnce() {
+    FloodFilter filter(1000);
+    QVERIFY(!filter.seen(1, 0));
+    QVERIFY(filter.seen(1, 10));
+    QVERIFY(!filter.seen(2, 10));
+    QCOMPARE(filter.size(), 2);
+    filter.clear();
+    QVERIFY(!filter.seen(1, 20));
+}
+
+// rememberedForAWindow checks that a fingerprint outlives one rotation of the
+// generations but not two, unless it is seen again in between
+void TestFloodFilter::rememberedForAWindow() {
+    FloodFilter filter(1000);
+    QVERIFY(!filter.seen(1, 0));
+    QVERIFY(!filter.seen(2, 0));
+    QVERIFY(!filter.seen(3, 1000));
+    QVERIFY(filter.seen(1, 1999));
+    QVERIFY(!filter.seen(4, 2000));
+    QVERIFY(filter.seen(1, 2000));
+    QVERIFY(!filter.seen(2, 2000));
+}
+
+void TestFloodFilter::idleFilterForgets() {
+    FloodFilter filter(1000);
+    filter.seen(1, 0);
+    QVERIFY(!filter.seen(1, 2500));
+}
+
+// capacityRotates fills the filter twice within one window; the oldest
+// fingerprints are forgotten early so memory stays bounded
+void TestFloodFilter::capacityRotates() {
+    FloodFilter filter(1000, 4);
+    for (quint64 i = 0; i < 9; i++)
+        QVERIFY(!filter.seen(i, 0));
+    QVERIFY(filter.size() <= 8);
+    QVERIFY(!filter.seen(0, 0));
+    QVERIFY(filter.seen(7, 0));
+}
+
+void TestFloodFilter::forget() {
+    FloodFilter filter(1000);
+    filter.seen(1, 0);
+    filter.seen(2, 1000);
+    filter.forget(1);
+    filter.forget(2);
+    QVERIFY(!filter.seen(1, 1000));
+    QVERIFY(!filter.seen(2, 1000));
+}
+
+// fingerprintIgnoresPath checks that copies relayed by different neighbors
+// match while another version does not
+void TestFloodFilter::fingerprintIgnoresPath() {
+    Packet a("", "echo", QByteArray("load"));
+    a.net = Packet::NetState::SERVICE;
+    a.seqNum = 4;
+    a.srcAddress = "B";
+    Packet b = a;
+    b.srcAddress = "C";
+    b.nxtAddress = "A";
+    QCOMPARE(FloodFilter::fingerprint(&a), FloodFilter::fingerprint(&b));
+    b.seqNum = 6;
+    QVERIFY(FloodFilter::fingerprint(&a) != FloodFilter::fingerprint(&b));
+    b.seqNum = 4;
+    b.data = "loae";
+    QVERIFY(FloodFilter::fingerprint(&a) != FloodFilter::fingerprint(&b));
+}
+
+void TestFloodFilter::seenRate_data() {
+    QTest::addColumn<double>("duplicates");
+    QTest::newRow("no duplicates") << 0.0;
+    QTest::newRow("3 copies each") << 2.0 / 3;
+}
+
+// seenRate checks 10k fingerprints a second apart, as a dense mesh delivers
+// flooded advertisements and their copies
+void TestFloodFilter::seenRate() {
+    QFETCH(double, duplicates);
+    FloodFilter filter(5000);
+    int copies = duplicates > 0 ? 3 : 1;
+    qint64 now = 0;
+    quint64 next = 0;
+    int dropped = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 10000; i++) {
+            if (filter.seen(next + (i / copies) * 0x9E3779B97F4A7C15ULL, now))
+                dropped++;
+            now++;
+        }
+        next += 10000;
+    }
+    QVERIFY(duplicates == 0 ? dropped == 0 : dropped > 0);
+}
+
+void TestFloodFilter::fingerprintRate() {
+    Packet p("", "echo", QByteArray(32, 'x'));
+    p.net = Packet::NetState::SERVICE;
+    p.seqNum = 4;
+    quint64 hash = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 10000; i++)
+            hash ^= FloodFilter::fingerprint(&p);
+    }
+    Q_UNUSED(hash);
+}
+
+QTEST_APPLESS_MAIN(TestFloodFilter)
+
+#include "tst_floodfilter.moc"
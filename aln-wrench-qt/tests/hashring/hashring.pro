@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_hashring
+
+SOURCES += \
+    $$ALN/hashring.cpp \
+    tst_hashring.cpp
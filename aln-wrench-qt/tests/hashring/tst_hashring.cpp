@@ -0,0 +1,160 @@
+#include <QtTest>
+#include "hashring.h"
+
+// hosts returns the addresses of count hosts, each with load 1
+static QStringList hosts(int count) {
+    QStringList addresses;
+    for (int i = 0; i < count; i++)
+        addresses.append(QString("node-%1").arg(i));
+    return addresses;
+}
+
+static QByteArray key(int n) {
+    return QByteArray("key-") + QByteArray::number(n);
+}
+
+class TestHashRing : public QObject {
+    Q_OBJECT
+
+private slots:
+    void emptyRing();
+    void independentOfOrder();
+    void keysSpread();
+    void joinMovesOwnKeys();
+    void overloadedHostPassedOver();
+    void skippedHostPassedOver();
+    void build_data();
+    void build();
+    void lookup_data();
+    void lookup();
+    void keysMovedOnJoin_data();
+    void keysMovedOnJoin();
+};
+
+void TestHashRing::emptyRing() {
+    HashRing ring;
+    QVERIFY(ring.isEmpty());
+    QCOMPARE(ring.host("key"), QString());
+    QCOMPARE(HashRing(QStringList(), QVector<short>()).host("key"), QString());
+}
+
+// independentOfOrder checks that nodes listing the hosts in different orders
+// map keys to the same hosts
+void TestHashRing::independentOfOrder() {
+    QStringList addresses = hosts(5);
+    QStringList reversed;
+    foreach (QString address, addresses)
+        reversed.prepend(address);
+    HashRing a(addresses, QVector<short>(5, 1));
+    HashRing b(reversed, QVector<short>(5, 1));
+    for (int n = 0; n < 1000; n++)
+        QCOMPARE(a.host(key(n)), b.host(key(n)));
+}
+
+// keysSpread maps 10000 keys to 4 hosts; each gets a quarter of them, give or
+// take a third
+void TestHashRing::keysSpread() {
+    HashRing ring(hosts(4), QVector<short>(4, 1));
+    QHash<QString, int> keys;
+    for (int n = 0; n < 10000; n++)
+        keys[ring.host(key(n))]++;
+    QCOMPARE(keys.size(), 4);
+    foreach (int count, keys.values())
+        QVERIFY2(count > 2500 * 2 / 3 && count < 2500 * 4 / 3, qPrintable(QString::number(count)));
+}
+
+// joinMovesOwnKeys adds a fifth host; the keys that move all move to it
+void TestHashRing::joinMovesOwnKeys() {
+    HashRing before(hosts(4), QVector<short>(4, 1));
+    HashRing after(hosts(5), QVector<short>(5, 1));
+    int moved = 0;
+    for (int n = 0; n < 10000; n++) {
+        QString host = after.host(key(n));
+        if (host != before.host(key(n))) {
+            QCOMPARE(host, QString("node-4"));
+            moved++;
+        }
+    }
+    QVERIFY(moved > 0 && moved < 3000);
+}
+
+// overloadedHostPassedOver loads one host beyond the bound; its keys go to
+// the others, and come back once its load falls
+void TestHashRing::overloadedHostPassedOver() {
+    HashRing loaded(hosts(4), QVector<short>({1, 1, 1, 10}));
+    HashRing even(hosts(4), QVector<short>(4, 1));
+    for (int n = 0; n < 1000; n++) {
+        QVERIFY(loaded.host(key(n)) != "node-3");
+        if (even.host(key(n)) != "node-3")
+            QCOMPARE(loaded.host(key(n)), even.host(key(n)));
+    }
+}
+
+// skippedHostPassedOver skips the host of a key, then every host
+void TestHashRing::skippedHostPassedOver() {
+    HashRing ring(hosts(3), QVector<short>(3, 1));
+    QString host = ring.host("key");
+    QSet<QString> skip;
+    skip.insert(host);
+    QString next = ring.host("key", skip);
+    QVERIFY(!next.isEmpty() && next != host);
+    foreach (QString address, hosts(3))
+        skip.insert(address);
+    QCOMPARE(ring.host("key", skip), host);
+}
+
+void TestHashRing::build_data() {
+    QTest::addColumn<int>("count");
+    QTest::newRow("10 hosts") << 10;
+    QTest::newRow("100 hosts") << 100;
+}
+
+// build places count hosts on a ring at the default 64 points each
+void TestHashRing::build() {
+    QFETCH(int, count);
+    QStringList addresses = hosts(count);
+    QVector<short> loads(count, 1);
+    QBENCHMARK {
+        HashRing ring(addresses, loads);
+        QVERIFY(!ring.isEmpty());
+    }
+}
+
+void TestHashRing::lookup_data() {
+    build_data();
+}
+
+// lookup maps 1000 keys to count hosts
+void TestHashRing::lookup() {
+    QFETCH(int, count);
+    HashRing ring(hosts(count), QVector<short>(count, 1));
+    QVector<QByteArray> keys;
+    for (int n = 0; n < 1000; n++)
+        keys.append(key(n));
+    QBENCHMARK {
+        foreach (const QByteArray& k, keys)
+            ring.host(k);
+    }
+}
+
+void TestHashRing::keysMovedOnJoin_data() {
+    build_data();
+}
+
+// keysMovedOnJoin counts which of 10000 keys change host when one more host
+// joins count hosts; an even share is 10000 / (count + 1)
+void TestHashRing::keysMovedOnJoin() {
+    QFETCH(int, count);
+    HashRing before(hosts(count), QVector<short>(count, 1));
+    HashRing after(hosts(count + 1), QVector<short>(count + 1, 1));
+    int moved = 0;
+    for (int n = 0; n < 10000; n++) {
+        if (after.host(key(n)) != before.host(key(n)))
+            moved++;
+    }
+    QTest::setBenchmarkResult(moved, QTest::Events);
+}
+
+QTEST_APPLESS_MAIN(TestHashRing)
+
+#include "tst_hashring.moc"
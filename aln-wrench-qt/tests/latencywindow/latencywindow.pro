@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_latencywindow
+
+SOURCES += \
+    $$ALN/latencywindow.cpp \
+    tst_latencywindow.cpp
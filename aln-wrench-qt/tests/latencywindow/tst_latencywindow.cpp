@@ -0,0 +1,90 @@
+#include <QtTest>
+#include "latencywindow.h"
+
+class TestLatencyWindow : public QObject {
+    Q_OBJECT
+
+private slots:
+    void fewSamplesUnknown();
+    void percentile_data();
+    void percentile();
+    void oldestReplaced();
+    void percentileRate_data();
+    void percentileRate();
+};
+
+void TestLatencyWindow::fewSamplesUnknown() {
+    LatencyWindow window;
+    QCOMPARE(window.percentile(0.5), -1.0);
+    window.add(10);
+    QCOMPARE(window.percentile(0.5), 10.0);
+    QCOMPARE(window.percentile(0.5, 2), -1.0);
+    window.add(20);
+    QCOMPARE(window.percentile(0.5, 2), 20.0);
+    QCOMPARE(window.size(), 2);
+}
+
+void TestLatencyWindow::percentile_data() {
+    QTest::addColumn<double>("q");
+    QTest::addColumn<double>("expected");
+    QTest::newRow("min") << 0.0 << 1.0;
+    QTest::newRow("median") << 0.5 << 51.0;
+    QTest::newRow("p95") << 0.95 << 96.0;
+    QTest::newRow("p99") << 0.99 << 100.0;
+    QTest::newRow("max") << 1.0 << 100.0;
+}
+
+// percentile reads the q quantile of 1 to 100 ms, added in a scrambled order
+void TestLatencyWindow::percentile() {
+    QFETCH(double, q);
+    QFETCH(double, expected);
+    LatencyWindow window(100);
+    for (int i = 0; i < 100; i++)
+        window.add((i * 37) % 100 + 1);
+    QCOMPARE(window.percentile(q), expected);
+    QCOMPARE(window.percentile(q), expected); // reading leaves the samples as they were
+}
+
+// oldestReplaced fills a window with slow responses and follows the service
+// as it speeds up
+void TestLatencyWindow::oldestReplaced() {
+    LatencyWindow window(8);
+    for (int i = 0; i < 8; i++)
+        window.add(100);
+    QCOMPARE(window.size(), 8);
+    for (int i = 0; i < 4; i++)
+        window.add(10);
+    QCOMPARE(window.size(), 8);
+    QCOMPARE(window.percentile(0.25), 10.0);
+    QCOMPARE(window.percentile(0.5), 100.0);
+    for (int i = 0; i < 4; i++)
+        window.add(10);
+    QCOMPARE(window.percentile(1.0), 10.0);
+}
+
+void TestLatencyWindow::percentileRate_data() {
+    QTest::addColumn<int>("capacity");
+    QTest::newRow("16 samples") << 16;
+    QTest::newRow("256 samples") << 256;
+}
+
+// percentileRate reads the 95th percentile once per response, as a hedged
+// service does
+void TestLatencyWindow::percentileRate() {
+    QFETCH(int, capacity);
+    LatencyWindow window(capacity);
+    for (int i = 0; i < capacity; i++)
+        window.add(i % 50);
+    double sum = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            window.add(i % 50);
+            sum += window.percentile(0.95);
+        }
+    }
+    QVERIFY(sum > 0);
+}
+
+QTEST_APPLESS_MAIN(TestLatencyWindow)
+
+#include "tst_latencywindow.moc"
@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_outlierdetector
+
+SOURCES += \
+    $$ALN/outlierdetector.cpp \
+    tst_outlierdetector.cpp
@@ -0,0 +1,165 @@
+#include <QtTest>
+#include "outlierdetector.h"
+
+static QString instance(int n) {
+    return QString("node-%1").arg(n);
+}
+
+// track has detector hear one 10 ms answer from each of count instances of "svc"
+static void track(OutlierDetector* detector, int count) {
+    for (int n = 0; n < count; n++)
+        detector->answered("svc", instance(n), 10, 0);
+}
+
+class TestOutlierDetector : public QObject {
+    Q_OBJECT
+
+private slots:
+    void failuresEject();
+    void answeredProbeReturns();
+    void failedProbeDoublesBackOff();
+    void slowInstanceEjected();
+    void atMostHalfEjected();
+    void pruneKeepsEjected();
+    void answered_data();
+    void answered();
+    void faultyInstance_data();
+    void faultyInstance();
+};
+
+void TestOutlierDetector::failuresEject() {
+    OutlierDetector detector;
+    track(&detector, 4);
+    for (int n = 0; n < 4; n++)
+        detector.timedOut("svc", instance(0), 0);
+    QVERIFY(!detector.isEjected("svc", instance(0), 0));
+    detector.timedOut("svc", instance(0), 0);
+    QVERIFY(detector.isEjected("svc", instance(0), 0));
+    QVERIFY(detector.isEjected("svc", instance(0), 999));
+    QVERIFY(!detector.isEjected("svc", instance(0), 1000));
+    QVERIFY(!detector.isEjected("svc", instance(1), 0));
+    QCOMPARE(detector.ejections(), (qint64)1);
+    QCOMPARE(detector.unhealthy(), 1);
+}
+
+// answeredProbeReturns lets one request through once the ejection is over;
+// others avoid the instance until the probe is answered
+void TestOutlierDetector::answeredProbeReturns() {
+    OutlierDetector detector;
+    track(&detector, 4);
+    for (int n = 0; n < 5; n++)
+        detector.timedOut("svc", instance(0), 0);
+    detector.sent("svc", instance(0), 1000);
+    QVERIFY(detector.isEjected("svc", instance(0), 1000));
+    detector.answered("svc", instance(0), 10, 1010);
+    QVERIFY(!detector.isEjected("svc", instance(0), 1010));
+    QCOMPARE(detector.unhealthy(), 0);
+}
+
+void TestOutlierDetector::failedProbeDoublesBackOff() {
+    OutlierDetector detector;
+    track(&detector, 4);
+    for (int n = 0; n < 5; n++)
+        detector.timedOut("svc", instance(0), 0);
+    detector.sent("svc", instance(0), 1000);
+    detector.timedOut("svc", instance(0), 1000);
+    QVERIFY(detector.isEjected("svc", instance(0), 2999));
+    QVERIFY(!detector.isEjected("svc", instance(0), 3000));
+    QCOMPARE(detector.ejections(), (qint64)2);
+}
+
+// slowInstanceEjected ejects an instance answering in 100 ms while the
+// others answer in 10 ms, once it has answered enough times to be judged
+void TestOutlierDetector::slowInstanceEjected() {
+    OutlierDetector detector;
+    for (int sample = 0; sample < 8; sample++) {
+        for (int n = 1; n < 4; n++)
+            detector.answered("svc", instance(n), 10, 0);
+    }
+    for (int sample = 0; sample < 7; sample++)
+        detector.answered("svc", instance(0), 100, 0);
+    QVERIFY(!detector.isEjected("svc", instance(0), 0));
+    detector.answered("svc", instance(0), 100, 0);
+    QVERIFY(detector.isEjected("svc", instance(0), 0));
+    QCOMPARE(detector.ejections(), (qint64)1);
+}
+
+void TestOutlierDetector::atMostHalfEjected() {
+    OutlierDetector detector;
+    track(&detector, 2);
+    for (int n = 0; n < 5; n++) {
+        detector.timedOut("svc", instance(0), 0);
+        detector.timedOut("svc", instance(1), 0);
+    }
+    QVERIFY(detector.isEjected("svc", instance(0), 0));
+    QVERIFY(!detector.isEjected("svc", instance(1), 0));
+    QCOMPARE(detector.ejections(), (qint64)1);
+}
+
+// pruneKeepsEjected forgets idle instances, but not while they are ejected
+void TestOutlierDetector::pruneKeepsEjected() {
+    OutlierDetector detector;
+    track(&detector, 4);
+    for (int n = 0; n < 5; n++)
+        detector.timedOut("svc", instance(0), 0);
+    detector.prune(500, 100);
+    QVERIFY(detector.isEjected("svc", instance(0), 500));
+    QCOMPARE(detector.unhealthy(), 1);
+    detector.prune(1000, 100);
+    QCOMPARE(detector.unhealthy(), 0);
+    detector.sent("svc", instance(0), 1000);
+    QVERIFY(!detector.isEjected("svc", instance(0), 1000));
+}
+
+void TestOutlierDetector::answered_data() {
+    QTest::addColumn<int>("count");
+    QTest::newRow("4 instances") << 4;
+    QTest::newRow("64 instances") << 64;
+}
+
+// answered records 1000 responses spread over count instances, each judged
+// against the median of the others
+void TestOutlierDetector::answered() {
+    QFETCH(int, count);
+    OutlierDetector detector;
+    for (int sample = 0; sample < 8; sample++)
+        track(&detector, count);
+    QBENCHMARK {
+        for (int n = 0; n < 1000; n++)
+            detector.answered("svc", instance(n % count), 10 + n % 7, 0);
+    }
+    QCOMPARE(detector.ejections(), (qint64)0);
+}
+
+void TestOutlierDetector::faultyInstance_data() {
+    QTest::addColumn<bool>("detection");
+    QTest::newRow("no detection") << false;
+    QTest::newRow("detection") << true;
+}
+
+// faultyInstance sends 10000 requests, one per ms, in turn to 10 instances of
+// which one never answers, skipping the instances detection ejects; it counts
+// the requests lost to the faulty one
+void TestOutlierDetector::faultyInstance() {
+    QFETCH(bool, detection);
+    OutlierDetector detector;
+    track(&detector, 10);
+    int lost = 0;
+    for (qint64 now = 0; now < 10000; now++) {
+        QString address = instance(now % 10);
+        if (detection && detector.isEjected("svc", address, now))
+            address = instance(1 + now % 9);
+        detector.sent("svc", address, now);
+        if (address == instance(0)) {
+            lost++;
+            detector.timedOut("svc", address, now);
+        } else {
+            detector.answered("svc", address, 10, now);
+        }
+    }
+    QTest::setBenchmarkResult(lost, QTest::Events);
+}
+
+QTEST_APPLESS_MAIN(TestOutlierDetector)
+
+#include "tst_outlierdetector.moc"
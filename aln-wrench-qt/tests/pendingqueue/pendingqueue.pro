@@ -0,0 +1,9 @@
+include(../tests.pri)
+
+TARGET = tst_pendingqueue
+
+SOURCES += \
+    $$ALN/alntypes.cpp \
+    $$ALN/packet.cpp \
+    $$ALN/pendingqueue.cpp \
+    tst_pendingqueue.cpp
@@ -0,0 +1,153 @@
+#include <QtTest>
+#include "pendingqueue.h"
+#include "packet.h"
+
+static Packet* packet(int n, QByteArray data = QByteArray()) {
+    return new Packet("node-0", (INT16U)n, data);
+}
+
+class TestPendingQueue : public QObject {
+    Q_OBJECT
+
+private slots:
+    void takeInOrder();
+    void perAddressBound();
+    void memoryBound();
+    void refusedPacketDeleted();
+    void expireAfterTtl();
+    void clear();
+    void enqueueTake_data();
+    void enqueueTake();
+};
+
+void TestPendingQueue::takeInOrder() {
+    PendingQueue queue;
+    QVERIFY(queue.isEmpty());
+    for (int n = 1; n <= 3; n++)
+        QVERIFY(queue.enqueue("node-0", packet(n), 0));
+    QVERIFY(queue.enqueue("node-1", packet(4), 0));
+    QCOMPARE(queue.size(), 4);
+    QVERIFY(queue.contains("node-0"));
+
+    QList<Packet*> packets = queue.take("node-0");
+    QCOMPARE(packets.size(), 3);
+    for (int n = 0; n < 3; n++)
+        QCOMPARE(packets[n]->ctx, (INT16U)(n + 1));
+    qDeleteAll(packets);
+    QVERIFY(!queue.contains("node-0"));
+    QVERIFY(queue.take("node-0").isEmpty());
+    QCOMPARE(queue.size(), 1);
+
+    qDeleteAll(queue.take("node-1"));
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.memoryUsage(), (qint64)0);
+}
+
+void TestPendingQueue::perAddressBound() {
+    PendingQueue queue(1000, 3);
+    for (int n = 0; n < 3; n++)
+        QVERIFY(queue.enqueue("node-0", packet(n), 0));
+    QVERIFY(!queue.enqueue("node-0", packet(3), 0));
+    QVERIFY(queue.enqueue("node-1", packet(4), 0));
+    QCOMPARE(queue.size(), 4);
+
+    // taking the packets makes room again
+    qDeleteAll(queue.take("node-0"));
+    QVERIFY(queue.enqueue("node-0", packet(5), 0));
+}
+
+// memoryBound fills a queue sized for two and a half packets across
+// destinations; the third is refused until memory is released
+void TestPendingQueue::memoryBound() {
+    QByteArray data(1000, 'x');
+    qint64 footprint;
+    {
+        PendingQueue probe;
+        probe.enqueue("node-0", packet(0, data), 0);
+        footprint = probe.memoryUsage();
+    }
+    QVERIFY(footprint > data.size());
+
+    PendingQueue queue(1000, 64, footprint * 5 / 2);
+    QVERIFY(queue.enqueue("node-0", packet(1, data), 0));
+    QVERIFY(queue.enqueue("node-1", packet(2, data), 0));
+    QCOMPARE(queue.memoryUsage(), 2 * footprint);
+    QVERIFY(!queue.enqueue("node-2", packet(3, data), 0));
+    QVERIFY(!queue.contains("node-2"));
+    QVERIFY(queue.enqueue("node-2", packet(4), 0)); // a smaller packet still fits
+
+    qDeleteAll(queue.take("node-0"));
+    QVERIFY(queue.enqueue("node-3", packet(5, data), 0));
+    QCOMPARE(queue.size(), 3);
+}
+
+void TestPendingQueue::refusedPacketDeleted() {
+    PendingQueue queue(1000, 1);
+    QByteArray payload(64, 'x');
+    QVERIFY(queue.enqueue("node-0", packet(0), 0));
+    QVERIFY(!queue.enqueue("node-0", packet(1, payload), 0));
+    QVERIFY(payload.isDetached());
+}
+
+// expireAfterTtl drops each packet once it has waited the ttl, oldest first
+void TestPendingQueue::expireAfterTtl() {
+    PendingQueue queue(100);
+    queue.enqueue("node-0", packet(0), 0);
+    queue.enqueue("node-0", packet(1), 50);
+    queue.enqueue("node-1", packet(2), 60);
+    QCOMPARE(queue.expire(99), 0);
+    QCOMPARE(queue.expire(100), 1);
+    QCOMPARE(queue.size(), 2);
+
+    QList<Packet*> packets = queue.take("node-0");
+    QCOMPARE(packets.size(), 1);
+    QCOMPARE(packets[0]->ctx, (INT16U)1);
+    qDeleteAll(packets);
+
+    QCOMPARE(queue.expire(160), 1);
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.memoryUsage(), (qint64)0);
+
+    // a changed ttl applies to the packets already held
+    queue.enqueue("node-0", packet(3), 200);
+    queue.setTtl(10);
+    QCOMPARE(queue.expire(210), 1);
+}
+
+void TestPendingQueue::clear() {
+    PendingQueue queue;
+    queue.enqueue("node-0", packet(0), 0);
+    queue.enqueue("node-1", packet(1), 0);
+    queue.clear();
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.size(), 0);
+    QCOMPARE(queue.memoryUsage(), (qint64)0);
+    QVERIFY(queue.enqueue("node-0", packet(2), 0));
+}
+
+void TestPendingQueue::enqueueTake_data() {
+    QTest::addColumn<int>("destinations");
+    QTest::newRow("1 destination") << 1;
+    QTest::newRow("64 destinations") << 64;
+}
+
+// enqueueTake queues 64 packets across destinations and flushes them, as
+// routes to them are learned
+void TestPendingQueue::enqueueTake() {
+    QFETCH(int, destinations);
+    QStringList addresses;
+    for (int n = 0; n < destinations; n++)
+        addresses << QString("node-%1").arg(n);
+    PendingQueue queue;
+    QBENCHMARK {
+        for (int n = 0; n < 64; n++)
+            queue.enqueue(addresses[n % destinations], packet(n), 0);
+        foreach (QString address, addresses)
+            qDeleteAll(queue.take(address));
+    }
+    QVERIFY(queue.isEmpty());
+}
+
+QTEST_APPLESS_MAIN(TestPendingQueue)
+
+#include "tst_pendingqueue.moc"
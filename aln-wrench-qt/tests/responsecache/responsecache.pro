@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_responsecache
+
+SOURCES += \
+    $$ALN/responsecache.cpp \
+    tst_responsecache.cpp
@@ -0,0 +1,144 @@
+#include <QtTest>
+#include "responsecache.h"
+
+// the bytes ResponseCache counts for a response of 10 bytes to request "r0"
+// of service "svc" from "B"
+#define ENTRY_BYTES (96 + 2 * (3 + 1) + 2 + 10)
+
+static QByteArray request(int n) {
+    return QByteArray("r") + QByteArray::number(n);
+}
+
+class TestResponseCache : public QObject {
+    Q_OBJECT
+
+private slots:
+    void hitAndMiss();
+    void expires();
+    void leastRecentlyUsedEvicted();
+    void oversizedNotHeld();
+    void removeService();
+    void lowerLimitShrinks();
+    void find_data();
+    void find();
+    void insertEvicting();
+};
+
+void TestResponseCache::hitAndMiss() {
+    ResponseCache cache;
+    QString responder;
+    QByteArray response;
+    QVERIFY(!cache.find("svc", request(0), 0, &responder, &response));
+    cache.insert("svc", request(0), "B", "0123456789", 1000, 0);
+    QVERIFY(cache.find("svc", request(0), 10, &responder, &response));
+    QCOMPARE(responder, QString("B"));
+    QCOMPARE(response, QByteArray("0123456789"));
+    QVERIFY(!cache.find("log", request(0), 10, &responder, &response));
+    QVERIFY(!cache.find("svc", request(1), 10, &responder, &response));
+    QCOMPARE(cache.stats().hits, (qint64)1);
+    QCOMPARE(cache.stats().misses, (qint64)3);
+    QCOMPARE(cache.stats().entries, 1);
+    QCOMPARE(cache.stats().bytes, (qint64)ENTRY_BYTES);
+}
+
+void TestResponseCache::expires() {
+    ResponseCache cache;
+    QString responder;
+    QByteArray response;
+    cache.insert("svc", request(0), "B", "0123456789", 1000, 0);
+    QVERIFY(cache.find("svc", request(0), 999, &responder, &response));
+    QVERIFY(!cache.find("svc", request(0), 1000, &responder, &response));
+    QCOMPARE(cache.stats().expired, (qint64)1);
+    QCOMPARE(cache.stats().entries, 0);
+    QCOMPARE(cache.stats().bytes, (qint64)0);
+}
+
+// leastRecentlyUsedEvicted fills the cache with three responses; the fourth
+// evicts the one used longest ago
+void TestResponseCache::leastRecentlyUsedEvicted() {
+    ResponseCache cache(3 * ENTRY_BYTES);
+    QString responder;
+    QByteArray response;
+    for (int n = 0; n < 3; n++)
+        cache.insert("svc", request(n), "B", "0123456789", 1000, 0);
+    QVERIFY(cache.find("svc", request(0), 0, &responder, &response));
+    cache.insert("svc", request(3), "B", "0123456789", 1000, 0);
+    QCOMPARE(cache.stats().evicted, (qint64)1);
+    QVERIFY(!cache.find("svc", request(1), 0, &responder, &response));
+    QVERIFY(cache.find("svc", request(0), 0, &responder, &response));
+    QVERIFY(cache.find("svc", request(2), 0, &responder, &response));
+    QVERIFY(cache.find("svc", request(3), 0, &responder, &response));
+}
+
+void TestResponseCache::oversizedNotHeld() {
+    ResponseCache cache(ENTRY_BYTES);
+    QString responder;
+    QByteArray response;
+    cache.insert("svc", request(0), "B", "0123456789", 1000, 0);
+    cache.insert("svc", request(1), "B", "0123456789a", 1000, 0);
+    QVERIFY(cache.find("svc", request(0), 0, &responder, &response));
+    QVERIFY(!cache.find("svc", request(1), 0, &responder, &response));
+    QCOMPARE(cache.stats().evicted, (qint64)0);
+}
+
+void TestResponseCache::removeService() {
+    ResponseCache cache;
+    QString responder;
+    QByteArray response;
+    cache.insert("svc", request(0), "B", "0123456789", 1000, 0);
+    cache.insert("log", request(0), "B", "0123456789", 1000, 0);
+    cache.remove("svc");
+    QVERIFY(!cache.find("svc", request(0), 0, &responder, &response));
+    QVERIFY(cache.find("log", request(0), 0, &responder, &response));
+    QCOMPARE(cache.stats().entries, 1);
+}
+
+void TestResponseCache::lowerLimitShrinks() {
+    ResponseCache cache;
+    for (int n = 0; n < 10; n++)
+        cache.insert("svc", request(n), "B", "0123456789", 1000, 0);
+    cache.setMemoryLimit(4 * ENTRY_BYTES);
+    QCOMPARE(cache.stats().entries, 4);
+    QCOMPARE(cache.stats().evicted, (qint64)6);
+    QVERIFY(cache.stats().bytes <= 4 * ENTRY_BYTES);
+}
+
+void TestResponseCache::find_data() {
+    QTest::addColumn<int>("entries");
+    QTest::newRow("100") << 100;
+    QTest::newRow("10k") << 10000;
+}
+
+// find looks up 1000 held responses among entries
+void TestResponseCache::find() {
+    QFETCH(int, entries);
+    ResponseCache cache(1 << 24);
+    for (int n = 0; n < entries; n++)
+        cache.insert("svc", request(n), "B", "0123456789", 1000, 0);
+    QString responder;
+    QByteArray response;
+    int hits = 0;
+    QBENCHMARK {
+        for (int n = 0; n < 1000; n++)
+            hits += cache.find("svc", request(n % entries), 0, &responder, &response);
+    }
+    QVERIFY(hits > 0);
+}
+
+// insertEvicting inserts 1000 responses into a full cache, each evicting the
+// least recently used one
+void TestResponseCache::insertEvicting() {
+    ResponseCache cache(100 * ENTRY_BYTES);
+    for (int n = 0; n < 100; n++)
+        cache.insert("svc", request(n), "B", "0123456789", 1000, 0);
+    int next = 100;
+    QBENCHMARK {
+        for (int n = 0; n < 1000; n++)
+            cache.insert("svc", request(next++ % 1000), "B", "0123456789", 1000, 0);
+    }
+    QVERIFY(cache.stats().entries <= 100);
+}
+
+QTEST_APPLESS_MAIN(TestResponseCache)
+
+#include "tst_responsecache.moc"
@@ -0,0 +1,34 @@
+include(../tests.pri)
+
+QT += network
+
+TARGET = tst_router
+
+SOURCES += \
+    $$ALN/alntypes.cpp \
+    $$ALN/channel.cpp \
+    $$ALN/contexttable.cpp \
+    $$ALN/floodfilter.cpp \
+    $$ALN/frame.cpp \
+    $$ALN/hashring.cpp \
+    $$ALN/latencywindow.cpp \
+    $$ALN/localchannel.cpp \
+    $$ALN/outlierdetector.cpp \
+    $$ALN/packet.cpp \
+    $$ALN/parser.cpp \
+    $$ALN/pendingqueue.cpp \
+    $$ALN/responsecache.cpp \
+    $$ALN/router.cpp \
+    $$ALN/routetable.cpp \
+    $$ALN/servicebalancer.cpp \
+    $$ALN/serviceexecutor.cpp \
+    $$ALN/servicetable.cpp \
+    $$ALN/tcpchannel.cpp \
+    tst_router.cpp
+
+HEADERS += \
+    $$ALN/channel.h \
+    $$ALN/localchannel.h \
+    $$ALN/parser.h \
+    $$ALN/router.h \
+    $$ALN/tcpchannel.h
@@ -0,0 +1,1266 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QQueue>
+#include <QTcpServer>
+#include "router.h"
+#include "tcpchannel.h"
+
+// TestChannel stands for a neighbor of the router under test and keeps the
+// packets sent to it
+class TestChannel : public Channel {
+public:
+    QList<Packet*> sent;
+
+    ~TestChannel() { qDeleteAll(sent); }
+    bool send(Packet* p) override { sent.append(p); return true; }
+    bool listen() override { return true; }
+    void disconnect() override {}
+
+    int count(char net) const {
+        int n = 0;
+        foreach (Packet* p, sent) {
+            if (p->net == net)
+                n++;
+        }
+        return n;
+    }
+    void clear() { qDeleteAll(sent); sent.clear(); }
+};
+
+// CountingChannel stands for a neighbor that drops the packets sent to it,
+// counting them from any thread
+class CountingChannel : public Channel {
+public:
+    std::atomic<int> sent;
+
+    CountingChannel() : sent(0) {}
+    bool send(Packet* p) override { sent++; delete p; return true; }
+    bool listen() override { return true; }
+    void disconnect() override {}
+};
+
+class Mesh;
+
+// MeshChannel is one end of a link between two routers of a Mesh
+class MeshChannel : public Channel {
+public:
+    Mesh* mesh;
+    Router* router; // the router at this end
+    MeshChannel* peer = nullptr;
+    bool up = true;
+
+    MeshChannel(Mesh* m, Router* r) : mesh(m), router(r) {}
+    bool send(Packet* p) override;
+    bool listen() override { return true; }
+    void disconnect() override {}
+};
+
+// Mesh connects routers through links whose packets wait in one queue until
+// run delivers them, so a test decides when the network makes progress. The
+// routers and their links are used from the test's thread only.
+class Mesh {
+public:
+    QList<Router*> routers;
+    QList<MeshChannel*> channels;
+    QQueue<QPair<MeshChannel*, Packet*>> queue; // (receiving end, packet)
+    qint64 controlPackets = 0;
+    qint64 controlBytes = 0;
+    int window;
+
+    Mesh(int updateWindow = 0) : window(updateWindow) {}
+    ~Mesh() {
+        while (!queue.isEmpty())
+            delete queue.dequeue().second;
+        qDeleteAll(routers);
+        qDeleteAll(channels);
+    }
+
+    Router* add(QString address) {
+        Router* router = new Router(address);
+        router->setUpdateWindow(window);
+        router->setRefreshInterval(0);
+        routers.append(router);
+        return router;
+    }
+
+    void link(Router* a, Router* b) {
+        MeshChannel* ca = new MeshChannel(this, a);
+        MeshChannel* cb = new MeshChannel(this, b);
+        ca->peer = cb;
+        cb->peer = ca;
+        channels.append(ca);
+        channels.append(cb);
+        a->addChannel(ca);
+        b->addChannel(cb);
+    }
+
+    // cut fails the link between a and b; packets on it are lost
+    void cut(Router* a, Router* b) {
+        foreach (MeshChannel* ca, channels) {
+            if (ca->up && ca->router == a && ca->peer->router == b) {
+                ca->up = ca->peer->up = false;
+                a->removeChannel(ca);
+                b->removeChannel(ca->peer);
+                return;
+            }
+        }
+    }
+
+    // run delivers packets until none is left, waiting out the update windows
+    // so that coalesced updates are sent too
+    void run() {
+        for (;;) {
+            while (!queue.isEmpty())
+                deliver();
+            if (window == 0)
+                return;
+            QTest::qWait(2 * window);
+            if (queue.isEmpty())
+                return;
+        }
+    }
+
+    // step delivers the packets sent so far but not those sent in response, so
+    // each step moves every packet one hop
+    void step() {
+        for (int n = queue.size(); n > 0; n--)
+            deliver();
+    }
+
+    void deliver() {
+        QPair<MeshChannel*, Packet*> delivery = queue.dequeue();
+        if (delivery.first->up)
+            delivery.first->router->onPacket(delivery.first, delivery.second);
+        else
+            delete delivery.second;
+    }
+
+    // converged returns whether every router has a route to exactly the routers
+    // it can reach over the links that are up, at the cost of the shortest path
+    bool converged() const {
+        foreach (Router* router, routers) {
+            QHash<Router*, int> hops = distances(router);
+            std::shared_ptr<const ForwardingState> state = router->forwardingState();
+            if (state->routes.size() != hops.size() - 1)
+                return false;
+            for (auto it = hops.constBegin(); it != hops.constEnd(); ++it) {
+                if (it.key() == router)
+                    continue;
+                RouteTable::Handle route = state->routes.find(it.key()->address());
+                if (route == RouteTable::NoRoute || state->routes.at(route).cost != it.value())
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // distances returns the hop counts from router to the routers it can reach
+    QHash<Router*, int> distances(Router* router) const {
+        QHash<Router*, int> hops;
+        QQueue<Router*> next;
+        hops.insert(router, 0);
+        next.enqueue(router);
+        while (!next.isEmpty()) {
+            Router* at = next.dequeue();
+            foreach (MeshChannel* channel, channels) {
+                Router* neighbor = channel->peer->router;
+                if (channel->up && channel->router == at && !hops.contains(neighbor)) {
+                    hops.insert(neighbor, hops.value(at) + 1);
+                    next.enqueue(neighbor);
+                }
+            }
+        }
+        return hops;
+    }
+
+    void resetCounters() {
+        controlPackets = 0;
+        controlBytes = 0;
+    }
+};
+
+bool MeshChannel::send(Packet* p) {
+    if (p->net != 0) {
+        mesh->controlPackets++;
+        mesh->controlBytes += p->toByteArray().size();
+    }
+    mesh->queue.enqueue(qMakePair(peer, p));
+    return true;
+}
+
+// EchoHandler answers each request with its own data
+class EchoHandler : public PacketHandler {
+public:
+    Router* router;
+    int requests = 0;
+
+    EchoHandler(Router* r) : router(r) {}
+    void onPacket(Packet* p) override {
+        requests++;
+        router->send(new Packet(p->srcAddress, p->ctx, p->data));
+    }
+};
+
+// GateHandler holds each call until the gate is opened
+class GateHandler : public PacketHandler {
+public:
+    QMutex mutex;
+    QWaitCondition changed;
+    bool entered = false;
+    bool opened = false;
+
+    void onPacket(Packet*) override {
+        QMutexLocker lock(&mutex);
+        entered = true;
+        changed.wakeAll();
+        while (!opened)
+            changed.wait(&mutex);
+    }
+    void waitEntered() {
+        QMutexLocker lock(&mutex);
+        while (!entered)
+            changed.wait(&mutex);
+    }
+    void open() {
+        QMutexLocker lock(&mutex);
+        opened = true;
+        changed.wakeAll();
+    }
+};
+
+// SleepHandler takes ms for each call
+class SleepHandler : public PacketHandler {
+public:
+    int ms;
+    std::atomic<int> calls;
+
+    SleepHandler(int m) : ms(m), calls(0) {}
+    void onPacket(Packet*) override {
+        QThread::msleep(ms);
+        calls++;
+    }
+};
+
+// routeShare and serviceShare build the advertisements a neighbor sends
+static Packet* routeShare(QString from, QString address, short cost, INT16U seq = 0) {
+    Packet* p = new Packet();
+    p->net = Packet::NetState::ROUTE;
+    p->srcAddress = from;
+    p->seqNum = seq;
+    QBuffer buffer(&p->data);
+    buffer.open(QIODevice::Append);
+    writeToBuffer(&buffer, (INT08U)address.length());
+    writeToBuffer(&buffer, address);
+    writeToBuffer(&buffer, (INT16U)cost);
+    return p;
+}
+
+static Packet* serviceShare(QString from, QString address, QString service, short load, INT16U seq = 0) {
+    Packet* p = new Packet();
+    p->net = Packet::NetState::SERVICE;
+    p->srcAddress = from;
+    p->seqNum = seq;
+    QBuffer buffer(&p->data);
+    buffer.open(QIODevice::Append);
+    writeToBuffer(&buffer, (INT08U)address.length());
+    writeToBuffer(&buffer, address);
+    writeToBuffer(&buffer, (INT08U)service.length());
+    writeToBuffer(&buffer, service);
+    writeToBuffer(&buffer, (INT16U)load);
+    return p;
+}
+
+// advertisedCost returns the cost carried by a route advertisement
+static INT16U advertisedCost(Packet* p) {
+    int offset = 1 + (INT08U)p->data.at(0);
+    return readINT16U((INT08U*)p->data.data() + offset);
+}
+
+// line links count routers of mesh in a row, and ring closes the row into a circle
+static void line(Mesh* mesh, int count) {
+    for (int i = 0; i < count; i++) {
+        Router* router = mesh->add(QString("node-%1").arg(i));
+        if (i > 0)
+            mesh->link(mesh->routers.at(i - 1), router);
+    }
+}
+
+static void ring(Mesh* mesh, int count) {
+    line(mesh, count);
+    mesh->link(mesh->routers.last(), mesh->routers.first());
+}
+
+// grid links rows x cols routers of mesh to their neighbors; router r * cols + c
+// is named "node-r-c"
+static void grid(Mesh* mesh, int rows, int cols) {
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            Router* router = mesh->add(QString("node-%1-%2").arg(r).arg(c));
+            if (c > 0)
+                mesh->link(mesh->routers.at(r * cols + c - 1), router);
+            if (r > 0)
+                mesh->link(mesh->routers.at((r - 1) * cols + c), router);
+        }
+    }
+}
+
+// fullMesh links each of count routers of mesh to every other one
+static void fullMesh(Mesh* mesh, int count) {
+    for (int i = 0; i < count; i++) {
+        Router* router = mesh->add(QString("node-%1").arg(i));
+        for (int j = 0; j < i; j++)
+            mesh->link(mesh->routers.at(j), router);
+    }
+}
+
+// routeCosts returns the costs of the advertisements of address among packets
+static QList<INT16U> routeCosts(const QList<Packet*>& packets, QString address) {
+    QList<INT16U> costs;
+    foreach (Packet* p, packets) {
+        if (p->net == Packet::NetState::ROUTE && p->data.mid(1, (INT08U)p->data.at(0)) == address.toUtf8())
+            costs.append(advertisedCost(p));
+    }
+    return costs;
+}
+
+// serviceLoads returns the loads of the advertisements of service among packets
+static QList<INT16U> serviceLoads(const QList<Packet*>& packets, QString service) {
+    QList<INT16U> loads;
+    foreach (Packet* p, packets) {
+        if (p->net != Packet::NetState::SERVICE)
+            continue;
+        int offset = 1 + (INT08U)p->data.at(0);
+        int length = (INT08U)p->data.at(offset);
+        if (p->data.mid(offset + 1, length) == service.toUtf8())
+            loads.append(readINT16U((INT08U*)p->data.data() + offset + 1 + length));
+    }
+    return loads;
+}
+
+// learnNodes has router learn nodes addresses, half through b and half through
+// c, each hosting one of services services
+static void learnNodes(Router* router, TestChannel* b, TestChannel* c, int nodes, int services) {
+    for (int i = 0; i < nodes; i++) {
+        TestChannel* channel = i % 2 ? b : c;
+        QString neighbor = i % 2 ? "B" : "C";
+        QString address = QString("node-%1").arg(i);
+        router->onPacket(channel, routeShare(neighbor, address, 2));
+        router->onPacket(channel, serviceShare(neighbor, address, QString("service-%1").arg(i % services), 1));
+    }
+    b->clear();
+    c->clear();
+}
+
+// hostTwice has router learn that neighbors B and C host "svc"; B is the
+// less loaded, so requests go to it first and hedges to C
+static void hostTwice(Router* router, TestChannel* b, TestChannel* c) {
+    router->onPacket(b, routeShare("B", "B", 1));
+    router->onPacket(b, serviceShare("B", "B", "svc", 1));
+    router->onPacket(c, routeShare("C", "C", 1));
+    router->onPacket(c, serviceShare("C", "C", "svc", 5));
+    b->clear();
+    c->clear();
+}
+
+// requests returns the requests for "svc" among packets
+static QList<Packet*> requests(const QList<Packet*>& packets) {
+    QList<Packet*> found;
+    foreach (Packet* p, packets) {
+        if (p->srv == "svc")
+            found.append(p);
+    }
+    return found;
+}
+
+// answer has from respond to request, through channel
+static void answer(Router* router, TestChannel* channel, QString from, Packet* request) {
+    Packet* response = new Packet(request->srcAddress, request->ctx, request->data);
+    response->srcAddress = from;
+    router->onPacket(channel, response);
+}
+
+// primeHedging has B answer the requests a hedged service needs after ms
+// each, so that later requests are hedged after about ms
+static void primeHedging(Router* router, TestChannel* b, int ms) {
+    for (int i = 0; i < ROUTER_HEDGE_MIN_SAMPLES; i++) {
+        router->request("", "svc", "prime", 10000, [](Packet*) { return false; });
+        QTest::qWait(ms);
+        answer(router, b, "B", requests(b->sent).last());
+    }
+    b->clear();
+}
+
+class TestRouter : public QObject {
+    Q_OBJECT
+
+private slots:
+    void channelLossWithdrawsNodes();
+    void channelLoss_data();
+    void channelLoss();
+    void removedChannelIsReleased();
+    void concurrentSends_data();
+    void concurrentSends();
+    void staleRouteExpires();
+    void unsequencedRouteSurvives();
+    void requestNeedsTimeout();
+    void requestEndsWithReceiver();
+    void echoRoundTrip_data();
+    void echoRoundTrip();
+    void coalescedUpdateKeepsLatest();
+    void nodeJoin_data();
+    void nodeJoin();
+    void nodeJoinControlPackets_data();
+    void nodeJoinControlPackets();
+    void reconnectedNodeReachable();
+    void failureConvergence_data();
+    void failureConvergence();
+    void poisonEveryEqualPath();
+    void failureControlBytes_data();
+    void failureControlBytes();
+    void serviceReadvertisedAfterLoss();
+    void serviceFlood_data();
+    void serviceFlood();
+    void serviceFloodControlPackets_data();
+    void serviceFloodControlPackets();
+    void failoverToAlternate();
+    void failoverLoss_data();
+    void failoverLoss();
+    void flowsSpreadOverEqualPaths();
+    void diamondThroughput_data();
+    void diamondThroughput();
+    void failedSendReleasesPacket();
+    void pendingQueriesOnce();
+    void releaseWaitsForHandler();
+    void hedgeToSecondInstance();
+    void hedgeBudget_data();
+    void hedgeBudget();
+    void saturatedServiceLoad_data();
+    void saturatedServiceLoad();
+    void pooledReplyOverTcp();
+};
+
+void TestRouter::channelLossWithdrawsNodes() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    learnNodes(&router, &b, &c, 100, 10);
+
+    router.removeChannel(&b);
+    QCOMPARE(c.count(Packet::NetState::ROUTE), 50);
+    QVERIFY(router.selectServiceAddresses("service-1").isEmpty());
+    QCOMPARE(router.selectServiceAddresses("service-2").size(), 10);
+    QCOMPARE(router.forwardingState()->routes.size(), 50);
+    QCOMPARE(router.nodeServices().size(), 51);
+}
+
+void TestRouter::channelLoss_data() {
+    QTest::addColumn<int>("nodes");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+}
+
+// channelLoss withdraws the half of the nodes and their services reached
+// through the lost channel
+void TestRouter::channelLoss() {
+    QFETCH(int, nodes);
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    learnNodes(&router, &b, &c, nodes, 50);
+
+    QBENCHMARK_ONCE {
+        router.removeChannel(&b);
+    }
+    QCOMPARE(c.count(Packet::NetState::ROUTE), nodes / 2);
+}
+
+// removedChannelIsReleased checks that a sender holding the forwarding state
+// keeps removeChannel from returning while the state routes through the channel
+void TestRouter::removedChannelIsReleased() {
+    TestChannel b;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.onPacket(&b, routeShare("B", "node-0", 2));
+    std::shared_ptr<const ForwardingState> state = router.forwardingState();
+    QCOMPARE(state->routes.at(state->routes.find("node-0")).channel, (Channel*)&b);
+
+    std::atomic<bool> removed(false);
+    QThread* remover = QThread::create([&router, &b, &removed] {
+        router.removeChannel(&b);
+        removed = true;
+    });
+    remover->start();
+    QTest::qSleep(50);
+    QVERIFY(!removed.load());
+    state.reset();
+    remover->wait();
+    delete remover;
+    QVERIFY(removed.load());
+    QCOMPARE(router.forwardingState()->routes.find("node-0"), RouteTable::NoRoute);
+}
+
+void TestRouter::concurrentSends_data() {
+    QTest::addColumn<int>("threads");
+    QTest::newRow("1") << 1;
+    QTest::newRow("2") << 2;
+    QTest::newRow("4") << 4;
+    QTest::newRow("8") << 8;
+}
+
+// concurrentSends splits sending packets to 1k nodes among threads senders
+void TestRouter::concurrentSends() {
+    QFETCH(int, threads);
+    const int packets = 100000;
+    CountingChannel b;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    QStringList addresses;
+    for (int i = 0; i < 1000; i++) {
+        addresses.append(QString("node-%1").arg(i));
+        router.onPacket(&b, routeShare("B", addresses.last(), 2));
+    }
+    router.forwardingState();
+    int sent = b.sent.load();
+
+    QBENCHMARK {
+        QList<QThread*> senders;
+        for (int t = 0; t < threads; t++) {
+            senders.append(QThread::create([&router, &addresses, t, threads, packets] {
+                for (int i = t; i < packets; i += threads)
+                    router.send(new Packet(addresses.at(i % addresses.size()), "echo", 0, QByteArray()));
+            }));
+        }
+        foreach (QThread* sender, senders)
+            sender->start();
+        foreach (QThread* sender, senders)
+            sender->wait();
+        qDeleteAll(senders);
+    }
+    QVERIFY(b.sent.load() - sent >= packets);
+}
+
+// staleRouteExpires refreshes one of two routes until the other expires
+void TestRouter::staleRouteExpires() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.setRouteExpiry(300);
+    router.onPacket(&b, routeShare("B", "node-0", 2, 2));
+    router.onPacket(&b, routeShare("B", "node-1", 2, 2));
+    c.clear();
+    for (int i = 0; i < 50 && router.forwardingState()->routes.find("node-0") != RouteTable::NoRoute; i++) {
+        QTest::qWait(50);
+        router.onPacket(&b, routeShare("B", "node-1", 2, 2));
+    }
+    QCOMPARE(router.forwardingState()->routes.find("node-0"), RouteTable::NoRoute);
+    QVERIFY(router.forwardingState()->routes.find("node-1") != RouteTable::NoRoute);
+    QCOMPARE(c.count(Packet::NetState::ROUTE), 1);
+}
+
+// unsequencedRouteSurvives keeps what a neighbor that never refreshes
+// advertised once, and withdraws nothing back to it
+void TestRouter::unsequencedRouteSurvives() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.setRouteExpiry(100);
+    router.setServiceExpiry(100);
+    router.onPacket(&b, routeShare("B", "B", 1));
+    router.onPacket(&b, serviceShare("B", "B", "echo", 1));
+    b.clear();
+    c.clear();
+    QTest::qWait(400);
+    QVERIFY(router.forwardingState()->routes.find("B") != RouteTable::NoRoute);
+    QCOMPARE(router.selectServiceAddress("echo"), QString("B"));
+    QVERIFY(b.sent.isEmpty());
+    QVERIFY(c.sent.isEmpty());
+}
+
+void TestRouter::requestNeedsTimeout() {
+    TestChannel b;
+    Router router("A");
+    router.addChannel(&b);
+    router.onPacket(&b, routeShare("B", "B", 1));
+    b.clear();
+    QString err = router.request("B", "echo", "ping", 0, [](Packet*) { return true; });
+    QVERIFY(!err.isEmpty());
+    QVERIFY(b.sent.isEmpty());
+}
+
+// requestEndsWithReceiver streams responses to a receiver and checks that
+// none is delivered once the receiver is gone
+void TestRouter::requestEndsWithReceiver() {
+    Mesh mesh;
+    Router* a = mesh.add("A");
+    Router* b = mesh.add("B");
+    mesh.link(a, b);
+    EchoHandler echo(b);
+    b->registerService("echo", &echo, 0);
+    mesh.run();
+
+    QObject* receiver = new QObject();
+    int responses = 0;
+    QVERIFY(a->request("B", "echo", "ping", 10000, receiver, [&responses](Packet*) {
+        responses++;
+        return true;
+    }).isEmpty());
+    mesh.run();
+    QCOMPARE(responses, 1);
+    QCOMPARE(echo.requests, 1);
+
+    // the receiver goes away while the second request is on its way
+    QVERIFY(a->request("B", "echo", "ping", 10000, receiver, [&responses](Packet*) {
+        responses++;
+        return true;
+    }).isEmpty());
+    delete receiver;
+    mesh.run();
+    QCOMPARE(echo.requests, 2);
+    QCOMPARE(responses, 1);
+}
+
+void TestRouter::echoRoundTrip_data() {
+    QTest::addColumn<int>("hops");
+    QTest::newRow("1 hop") << 1;
+    QTest::newRow("4 hops") << 4;
+}
+
+// echoRoundTrip sends requests along a line of routers to an echo service
+// and waits for each response
+void TestRouter::echoRoundTrip() {
+    QFETCH(int, hops);
+    Mesh mesh;
+    Router* client = mesh.add("node-0");
+    Router* server = client;
+    for (int i = 1; i <= hops; i++) {
+        Router* next = mesh.add(QString("node-%1").arg(i));
+        mesh.link(server, next);
+        server = next;
+    }
+    EchoHandler echo(server);
+    server->registerService("echo", &echo, 0);
+    mesh.run();
+    QVERIFY(mesh.converged());
+
+    int requests = 0;
+    int responses = 0;
+    QBENCHMARK {
+        requests++;
+        client->request(server->address(), "echo", "ping", 1000, [&responses](Packet* p) {
+            if (p->data == "ping")
+                responses++;
+            return false;
+        });
+        mesh.run();
+    }
+    QCOMPARE(responses, requests);
+}
+
+// coalescedUpdateKeepsLatest improves a route twice within one update window;
+// the other neighbor hears of the better cost only
+void TestRouter::coalescedUpdateKeepsLatest() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(100);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.onPacket(&b, routeShare("B", "node-0", 3));
+    router.onPacket(&b, routeShare("B", "node-0", 2));
+    QCOMPARE(c.count(Packet::NetState::ROUTE), 0);
+    QTRY_COMPARE(c.count(Packet::NetState::ROUTE), 1);
+    QCOMPARE(advertisedCost(c.sent.last()), (INT16U)3);
+    QCOMPARE(b.count(Packet::NetState::ROUTE), 0);
+}
+
+void TestRouter::nodeJoin_data() {
+    QTest::addColumn<int>("window");
+    QTest::newRow("immediate") << 0;
+    QTest::newRow("coalesced") << ROUTER_UPDATE_WINDOW_MS;
+}
+
+// convergeGrid converges a 10 x 20 grid and adds the node that joins it
+static Router* convergeGrid(Mesh* mesh) {
+    grid(mesh, 10, 20);
+    mesh->run();
+    mesh->resetCounters();
+    return mesh->add("joining");
+}
+
+// joinGrid links the joining node to a corner router and its two neighbors
+static void joinGrid(Mesh* mesh, Router* joining) {
+    mesh->link(mesh->routers.at(0), joining);
+    mesh->link(mesh->routers.at(1), joining);
+    mesh->link(mesh->routers.at(20), joining);
+    mesh->run();
+}
+
+// nodeJoin measures the time until every router of a 200-node grid has a
+// route to a node that joins it, and the other way around
+void TestRouter::nodeJoin() {
+    QFETCH(int, window);
+    Mesh mesh(window);
+    Router* joining = convergeGrid(&mesh);
+    QBENCHMARK_ONCE {
+        joinGrid(&mesh, joining);
+    }
+    QVERIFY(mesh.converged());
+}
+
+void TestRouter::nodeJoinControlPackets_data() {
+    nodeJoin_data();
+}
+
+// nodeJoinControlPackets counts the control packets sent during the join of nodeJoin
+void TestRouter::nodeJoinControlPackets() {
+    QFETCH(int, window);
+    Mesh mesh(window);
+    joinGrid(&mesh, convergeGrid(&mesh));
+    QVERIFY(mesh.converged());
+    QTest::setBenchmarkResult(mesh.controlPackets, QTest::Events);
+}
+
+// reconnectedNodeReachable cuts the end of a line off and links it again; its
+// old sequence number is outbid by the withdrawal the others hold, which is
+// sent back to it so it advertises a newer one without waiting for a refresh
+void TestRouter::reconnectedNodeReachable() {
+    Mesh mesh;
+    line(&mesh, 3);
+    mesh.run();
+    Router* a = mesh.routers.at(0);
+    Router* b = mesh.routers.at(1);
+    Router* c = mesh.routers.at(2);
+    mesh.cut(b, c);
+    mesh.run();
+    QCOMPARE(a->forwardingState()->routes.find("node-2"), RouteTable::NoRoute);
+    mesh.link(b, c);
+    mesh.run();
+    QVERIFY(a->forwardingState()->routes.find("node-2") != RouteTable::NoRoute);
+    QVERIFY(mesh.converged());
+}
+
+void TestRouter::failureConvergence_data() {
+    QTest::addColumn<QString>("topology");
+    QTest::newRow("line") << QString("line");
+    QTest::newRow("ring") << QString("ring");
+    QTest::newRow("grid") << QString("grid");
+}
+
+// failureConvergence measures the time until 16 routers agree on their routes
+// again after the link in the middle of their topology fails
+void TestRouter::failureConvergence() {
+    QFETCH(QString, topology);
+    Mesh mesh(ROUTER_UPDATE_WINDOW_MS);
+    if (topology == "line")
+        line(&mesh, 16);
+    else if (topology == "ring")
+        ring(&mesh, 16);
+    else
+        grid(&mesh, 4, 4);
+    mesh.run();
+    QVERIFY(mesh.converged());
+    Router* a = mesh.routers.at(topology == "grid" ? 5 : 7);
+    Router* b = mesh.routers.at(topology == "grid" ? 6 : 8);
+    QBENCHMARK_ONCE {
+        mesh.cut(a, b);
+        mesh.run();
+    }
+    QVERIFY(mesh.converged());
+}
+
+// poisonEveryEqualPath reaches node-0 through B and C at the same cost; with
+// poison reverse neither of them is told the route is available through A
+void TestRouter::poisonEveryEqualPath() {
+    TestChannel b, c, e;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.setPoisonReverse(true);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.addChannel(&e);
+    router.onPacket(&b, routeShare("B", "node-0", 2, 2));
+    router.onPacket(&c, routeShare("C", "node-0", 2, 2));
+    QCOMPARE(router.forwardingState()->routes.at(router.forwardingState()->routes.find("node-0")).equalHops.size(), 1);
+    b.clear();
+    c.clear();
+    e.clear();
+
+    // a triggered update under the origin's next number
+    router.onPacket(&b, routeShare("B", "node-0", 2, 4));
+    router.onPacket(&c, routeShare("C", "node-0", 2, 4));
+    QCOMPARE(routeCosts(b.sent, "node-0"), QList<INT16U>({ROUTE_COST_INFINITY}));
+    QCOMPARE(routeCosts(c.sent, "node-0"), QList<INT16U>({ROUTE_COST_INFINITY}));
+    QCOMPARE(routeCosts(e.sent, "node-0"), QList<INT16U>({3}));
+
+    // the full table, as sent when C queries it
+    c.clear();
+    Packet* query = new Packet();
+    query->net = Packet::NetState::QUERY;
+    router.onPacket(&c, query);
+    QCOMPARE(routeCosts(c.sent, "node-0"), QList<INT16U>({ROUTE_COST_INFINITY}));
+}
+
+void TestRouter::failureControlBytes_data() {
+    QTest::addColumn<bool>("poisonReverse");
+    QTest::newRow("split horizon") << false;
+    QTest::newRow("poison reverse") << true;
+}
+
+// failureControlBytes counts the control bytes sent while a 4 x 4 grid
+// converges after one of its links fails
+void TestRouter::failureControlBytes() {
+    QFETCH(bool, poisonReverse);
+    Mesh mesh;
+    grid(&mesh, 4, 4);
+    foreach (Router* router, mesh.routers)
+        router->setPoisonReverse(poisonReverse);
+    mesh.run();
+    mesh.resetCounters();
+    mesh.cut(mesh.routers.at(5), mesh.routers.at(6));
+    mesh.run();
+    QVERIFY(mesh.converged());
+    QTest::setBenchmarkResult(mesh.controlBytes, QTest::Events);
+}
+
+// serviceReadvertisedAfterLoss loses the only channel to a node and learns it
+// again through another one, whose neighbor repeats the service advertisement
+// already seen through the first
+void TestRouter::serviceReadvertisedAfterLoss() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.onPacket(&b, routeShare("B", "node-0", 2));
+    router.onPacket(&b, serviceShare("B", "node-0", "service-0", 1, 2));
+    QCOMPARE(router.selectServiceAddresses("service-0"), QStringList({"node-0"}));
+
+    router.removeChannel(&b);
+    QVERIFY(router.selectServiceAddresses("service-0").isEmpty());
+    router.addChannel(&c);
+    router.onPacket(&c, routeShare("C", "node-0", 2));
+    router.onPacket(&c, serviceShare("C", "node-0", "service-0", 1, 2));
+    QCOMPARE(router.selectServiceAddresses("service-0"), QStringList({"node-0"}));
+}
+
+void TestRouter::serviceFlood_data() {
+    QTest::addColumn<int>("routers");
+    QTest::newRow("8") << 8;
+    QTest::newRow("16") << 16;
+}
+
+// serviceFlood measures the time until every router of a full mesh knows of a
+// service registered at one of them
+void TestRouter::serviceFlood() {
+    QFETCH(int, routers);
+    Mesh mesh;
+    fullMesh(&mesh, routers);
+    mesh.run();
+    EchoHandler echo(mesh.routers.first());
+    QBENCHMARK_ONCE {
+        mesh.routers.first()->registerService("echo", &echo, 0);
+        mesh.run();
+    }
+    foreach (Router* router, mesh.routers)
+        QCOMPARE(router->selectServiceAddress("echo"), QString("node-0"));
+}
+
+void TestRouter::serviceFloodControlPackets_data() {
+    serviceFlood_data();
+}
+
+// serviceFloodControlPackets counts the control packets sent while the service
+// of serviceFlood spreads; duplicates arriving over other paths are not relayed
+void TestRouter::serviceFloodControlPackets() {
+    QFETCH(int, routers);
+    Mesh mesh;
+    fullMesh(&mesh, routers);
+    mesh.run();
+    mesh.resetCounters();
+    EchoHandler echo(mesh.routers.first());
+    mesh.routers.first()->registerService("echo", &echo, 0);
+    mesh.run();
+    foreach (Router* router, mesh.routers)
+        QCOMPARE(router->selectServiceAddress("echo"), QString("node-0"));
+    QTest::setBenchmarkResult(mesh.controlPackets, QTest::Events);
+}
+
+// flowThroughFailure sends one packet per step from node-0 to the echo service
+// of node-2 and fails the link between node-0 and node-1 halfway through; it
+// returns the number of packets lost
+static int flowThroughFailure(Mesh* mesh, EchoHandler* echo, int packets) {
+    Router* source = mesh->routers.at(0);
+    int delivered = echo->requests;
+    for (int i = 0; i < packets; i++) {
+        if (i == packets / 2)
+            mesh->cut(source, mesh->routers.at(1));
+        source->send(new Packet("node-2", "echo", QByteArray("flow")));
+        mesh->step();
+    }
+    mesh->run();
+    return packets - (echo->requests - delivered);
+}
+
+// failoverToAlternate cuts the first link on the path from node-0 to node-2 in
+// a ring of 5; node-4 is a loop-free alternate, so the route moves to it before
+// any other router hears of the failure
+void TestRouter::failoverToAlternate() {
+    Mesh mesh;
+    ring(&mesh, 5);
+    Router* a = mesh.routers.at(0);
+    EchoHandler echo(mesh.routers.at(2));
+    mesh.routers.at(2)->registerService("echo", &echo, 0);
+    foreach (Router* router, mesh.routers)
+        router->setPendingTimeout(0);
+    mesh.run();
+
+    mesh.cut(a, mesh.routers.at(1));
+    std::shared_ptr<const ForwardingState> state = a->forwardingState();
+    RouteTable::Handle route = state->routes.find("node-2");
+    QVERIFY(route != RouteTable::NoRoute);
+    QCOMPARE(state->routes.at(route).nextHop, QString("node-4"));
+    QCOMPARE(a->send(new Packet("node-2", "echo", QByteArray("flow"))), QString());
+    mesh.run();
+    QCOMPARE(echo.requests, 1);
+    QVERIFY(mesh.converged());
+}
+
+void TestRouter::failoverLoss_data() {
+    QTest::addColumn<int>("routers");
+    QTest::newRow("ring 5, alternate") << 5;
+    QTest::newRow("ring 6, no alternate") << 6;
+}
+
+// failoverLoss counts the packets of a flow lost to a link failure, with no
+// pending queue to hold them; at one packet per step it is also the recovery
+// time in hops
+void TestRouter::failoverLoss() {
+    QFETCH(int, routers);
+    Mesh mesh;
+    ring(&mesh, routers);
+    EchoHandler echo(mesh.routers.at(2));
+    mesh.routers.at(2)->registerService("echo", &echo, 0);
+    foreach (Router* router, mesh.routers)
+        router->setPendingTimeout(0);
+    mesh.run();
+    int lost = flowThroughFailure(&mesh, &echo, 100);
+    QVERIFY(mesh.converged());
+    QTest::setBenchmarkResult(lost, QTest::Events);
+}
+
+// flowsSpreadOverEqualPaths reaches node-0 through B and C at the same cost;
+// flows are spread over both, and the packets of a flow keep to one
+void TestRouter::flowsSpreadOverEqualPaths() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.onPacket(&b, routeShare("B", "node-0", 2, 2));
+    router.onPacket(&c, routeShare("C", "node-0", 2, 2));
+    b.clear();
+    c.clear();
+
+    for (INT16U ctx = 1; ctx <= 100; ctx++) {
+        router.send(new Packet("node-0", ctx, QByteArray("first")));
+        router.send(new Packet("node-0", ctx, QByteArray("second")));
+    }
+    QCOMPARE(b.sent.size() + c.sent.size(), 200);
+    QVERIFY(b.sent.size() >= 60);
+    QVERIFY(c.sent.size() >= 60);
+    foreach (Packet* p, b.sent) {
+        foreach (Packet* q, c.sent)
+            QVERIFY(p->ctx != q->ctx);
+    }
+}
+
+void TestRouter::diamondThroughput_data() {
+    QTest::addColumn<bool>("equalPaths");
+    QTest::newRow("one path") << false;
+    QTest::newRow("two paths") << true;
+}
+
+// diamondThroughput forwards packets of 1000 flows from the top of a diamond
+// to its bottom, through one or both of its sides
+void TestRouter::diamondThroughput() {
+    QFETCH(bool, equalPaths);
+    CountingChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    router.onPacket(&b, routeShare("B", "node-0", 2, 2));
+    if (equalPaths)
+        router.onPacket(&c, routeShare("C", "node-0", 2, 2));
+    b.sent = 0;
+    c.sent = 0;
+
+    int packets = 0;
+    QBENCHMARK {
+        for (INT16U ctx = 1; ctx <= 1000; ctx++)
+            router.send(new Packet("node-0", ctx, QByteArray(64, 'x')));
+        packets += 1000;
+    }
+    QCOMPARE(b.sent + c.sent, packets);
+    QCOMPARE(c.sent > 0, equalPaths);
+}
+
+// failedSendReleasesPacket checks that each way a packet can fail to be sent
+// deletes it; the packets share payload until then
+void TestRouter::failedSendReleasesPacket() {
+    Router router("A");
+    router.setPendingTimeout(0);
+    QByteArray payload(64, 'x');
+    QVERIFY(!router.send(new Packet("node-0", 1, payload)).isEmpty());
+    QVERIFY(!router.send(new Packet(QString(), 1, payload)).isEmpty());
+    Packet* relayed = new Packet("node-0", 1, payload);
+    relayed->nxtAddress = "B";
+    QVERIFY(!router.send(relayed).isEmpty());
+    QVERIFY(!router.request("node-0", "echo", payload, 1000, [](Packet*) { return true; }).isEmpty());
+    QVERIFY(payload.isDetached());
+
+    // with the pending queue back, the packets beyond its bound per destination
+    router.setPendingTimeout(ROUTER_PENDING_TTL_MS);
+    for (int i = 0; i < ROUTER_PENDING_PER_ADDRESS; i++)
+        QVERIFY(router.send(new Packet("node-0", 1, QByteArray())).isEmpty());
+    QVERIFY(!router.send(new Packet("node-0", 1, payload)).isEmpty());
+    QVERIFY(payload.isDetached());
+}
+
+// pendingQueriesOnce holds packets for destinations without a route, queries
+// each destination once, and sends its packets in order once a route is learned
+void TestRouter::pendingQueriesOnce() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    b.clear();
+    c.clear();
+    for (int i = 0; i < 5; i++) {
+        QVERIFY(router.send(new Packet("node-0", (INT16U)i, QByteArray())).isEmpty());
+        QVERIFY(router.send(new Packet("node-1", (INT16U)i, QByteArray())).isEmpty());
+    }
+    QCOMPARE(b.count(Packet::NetState::QUERY), 2);
+    QCOMPARE(c.count(Packet::NetState::QUERY), 2);
+    QCOMPARE(b.sent.size(), 2);
+    b.clear();
+    c.clear();
+
+    router.onPacket(&b, routeShare("B", "node-0", 2));
+    QList<INT16U> flushed;
+    foreach (Packet* p, b.sent) {
+        if (p->net == 0 && p->destAddress == "node-0")
+            flushed.append(p->ctx);
+    }
+    QCOMPARE(flushed, (QList<INT16U>() << 0 << 1 << 2 << 3 << 4));
+
+    // the next packet to a still unknown destination does not query again
+    QVERIFY(router.send(new Packet("node-1", 5, QByteArray())).isEmpty());
+    QCOMPARE(c.count(Packet::NetState::QUERY), 0);
+}
+
+// releaseWaitsForHandler releases a context while its handler runs on another
+// thread; the release returns only after the call, so the handler can then be
+// deleted
+void TestRouter::releaseWaitsForHandler() {
+    Router router("A");
+    GateHandler* handler = new GateHandler();
+    INT16U ctx = router.registerContextHandler(handler);
+    QThread* receiver = QThread::create([&router, ctx] {
+        router.send(new Packet("A", ctx, QByteArray("response")));
+    });
+    receiver->start();
+    handler->waitEntered();
+
+    std::atomic<bool> released(false);
+    QThread* owner = QThread::create([&router, &released, ctx] {
+        router.releaseContext(ctx);
+        released = true;
+    });
+    owner->start();
+    QTest::qSleep(50);
+    bool early = released.load();
+    handler->open();
+    owner->wait();
+    receiver->wait();
+    delete owner;
+    delete receiver;
+    delete handler;
+    QVERIFY(!early);
+    QVERIFY(released.load());
+}
+
+// hedgeToSecondInstance leaves a request to the slow instance unanswered; a
+// copy goes to the other instance once the request has waited the percentile
+// of the response times, and whichever instance answers first is the only one
+// heard
+void TestRouter::hedgeToSecondInstance() {
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.setRefreshInterval(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    hostTwice(&router, &b, &c);
+    router.setHedging("svc", 0.95, 1.0);
+    primeHedging(&router, &b, 20);
+
+    QStringList responders;
+    QElapsedTimer clock;
+    clock.start();
+    QVERIFY(router.request("", "svc", "ping", 10000, [&responders](Packet* p) {
+        responders.append(p->srcAddress);
+        return true;
+    }).isEmpty());
+    QCOMPARE(requests(b.sent).size(), 1);
+    QTest::qWait(10);
+    QVERIFY(requests(c.sent).isEmpty());
+    QTRY_COMPARE(requests(c.sent).size(), 1);
+    QVERIFY(clock.elapsed() >= 20);
+    Packet* first = requests(b.sent).first();
+    Packet* hedge = requests(c.sent).first();
+    QCOMPARE(hedge->ctx, first->ctx);
+    QCOMPARE(hedge->data, first->data);
+
+    // the fast instance answers first; the slow one's late answer is dropped
+    answer(&router, &c, "C", hedge);
+    answer(&router, &b, "B", first);
+    QCOMPARE(responders, QStringList() << "C");
+    answer(&router, &c, "C", hedge);
+    QCOMPARE(responders, QStringList() << "C" << "C");
+}
+
+void TestRouter::hedgeBudget_data() {
+    QTest::addColumn<double>("rate");
+    QTest::addColumn<int>("hedges");
+    // the primed requests save up 16 times rate hedges and the 12 unanswered
+    // ones add 12 times rate, up to the burst
+    QTest::newRow("a quarter") << 0.25 << 7;
+    QTest::newRow("burst") << 1.0 << ROUTER_HEDGE_BURST;
+}
+
+// hedgeBudget leaves 12 requests unanswered and counts the hedges sent
+void TestRouter::hedgeBudget() {
+    QFETCH(double, rate);
+    QFETCH(int, hedges);
+    TestChannel b, c;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.setRefreshInterval(0);
+    router.addChannel(&b);
+    router.addChannel(&c);
+    hostTwice(&router, &b, &c);
+    router.setHedging("svc", 0.95, rate);
+    primeHedging(&router, &b, 5);
+
+    for (int i = 0; i < 12; i++)
+        QVERIFY(router.request("", "svc", "ping", 10000, [](Packet*) { return true; }).isEmpty());
+    QCOMPARE(requests(b.sent).size(), 12);
+    QTest::qWait(200);
+    QCOMPARE(requests(c.sent).size(), hedges);
+}
+
+void TestRouter::saturatedServiceLoad_data() {
+    QTest::addColumn<int>("interval");
+    QTest::newRow("every sample") << 1;
+    QTest::newRow("rate limited") << ROUTER_LOAD_INTERVAL_MS;
+}
+
+// saturatedServiceLoad queues requests for a slow local service and reads the
+// loads a neighbor is sent: the load follows the queue and the call time, each
+// advertised load differs from the previous one by the hysteresis, changes are
+// advertised at most once per interval, and a steady load not again
+void TestRouter::saturatedServiceLoad() {
+    QFETCH(int, interval);
+    TestChannel b;
+    Router router("A");
+    router.setUpdateWindow(0);
+    router.setRefreshInterval(0);
+    router.setLoadInterval(interval);
+    router.addChannel(&b);
+    SleepHandler handler(5);
+    router.registerService("slow", &handler, 1, 1000);
+    QCOMPARE(serviceLoads(b.sent, "slow"), QList<INT16U>() << 1);
+    b.clear();
+
+    // 300 calls keep the worker busy for 1.5 s
+    QElapsedTimer clock;
+    clock.start();
+    for (int i = 0; i < 300; i++)
+        router.onPacket(&b, new Packet("A", "slow", (INT16U)(i + 1), QByteArray()));
+    QTRY_COMPARE(handler.calls.load(), 300);
+    QTest::qWait(interval + ROUTER_LOAD_SAMPLE_MS); // the drained load is advertised
+    qint64 elapsed = clock.elapsed();
+    QList<INT16U> loads = serviceLoads(b.sent, "slow");
+    QVERIFY(loads.size() >= 2);
+    QVERIFY(loads.size() <= elapsed / qMax(interval, ROUTER_LOAD_SAMPLE_MS) + 1);
+    QVERIFY(loads.first() > 100); // about 5 ms times the calls queued
+    QVERIFY(loads.last() < 20);   // one call of about 5 ms
+    for (int i = 1; i < loads.size(); i++) {
+        int change = qAbs(loads[i] - loads[i - 1]);
+        QVERIFY(change >= 2 && change >= loads[i - 1] * ROUTER_LOAD_HYSTERESIS);
+    }
+
+    b.clear();
+    QTest::qWait(1000);
+    QVERIFY(serviceLoads(b.sent, "slow").isEmpty());
+}
+
+// threadWarnings counts the warnings Qt gives when a socket is used from a
+// thread other than its own
+static QAtomicInt threadWarnings;
+static QtMessageHandler previousHandler;
+
+static void countThreadWarnings(QtMsgType type, const QMessageLogContext& context, const QString& msg) {
+    if (type == QtWarningMsg && msg.contains("another thread"))
+        threadWarnings.fetchAndAddRelaxed(1);
+    previousHandler(type, context, msg);
+}
+
+// pooledReplyOverTcp answers requests from a pooled service over TcpChannels;
+// the replies leave the workers but are written from the socket's thread
+void TestRouter::pooledReplyOverTcp() {
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket* client = new QTcpSocket(&server);
+    client->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(server.waitForNewConnection(5000));
+    QVERIFY(client->waitForConnected(5000));
+    QTcpSocket* accepted = server.nextPendingConnection();
+
+    TcpChannel ca(client);
+    TcpChannel cb(accepted);
+    Router a("A");
+    Router b("B");
+    a.addChannel(&ca);
+    b.addChannel(&cb);
+    EchoHandler echo(&b);
+    b.registerService("echo", &echo, 1);
+    QTRY_COMPARE(a.selectServiceAddress("echo"), QString("B"));
+
+    threadWarnings.storeRelaxed(0);
+    previousHandler = qInstallMessageHandler(countThreadWarnings);
+    int responses = 0;
+    for (int i = 0; i < 20; i++) {
+        QVERIFY(a.request("B", "echo", "ping", 10000, [&responses](Packet*) {
+            responses++;
+            return true;
+        }).isEmpty());
+    }
+    QTRY_COMPARE(responses, 20);
+    qInstallMessageHandler(previousHandler);
+    QCOMPARE(threadWarnings.loadRelaxed(), 0);
+}
+
+QTEST_GUILESS_MAIN(TestRouter)
+
+#include "tst_router.moc"
@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_routetable
+
+SOURCES += \
+    $$ALN/routetable.cpp \
+    tst_routetable.cpp
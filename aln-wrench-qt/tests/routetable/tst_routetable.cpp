@@ -0,0 +1,151 @@
+#include <QHash>
+#include <QtTest>
+#include "routetable.h"
+
+static QStringList makeAddresses(int n) {
+    QStringList addresses;
+    for (int i = 0; i < n; i++)
+        addresses.append(QString("node-%1").arg(i));
+    return addresses;
+}
+
+class TestRouteTable : public QObject {
+    Q_OBJECT
+
+private slots:
+    void insertAndFind();
+    void handlesSurviveGrowth();
+    void removeKeepsProbeRuns();
+    void removedHandlesAreReused();
+    void clearReleasesMemory();
+    void lookup_data();
+    void lookup();
+    void lookupQHash_data();
+    void lookupQHash();
+    void memoryPerRoute_data();
+    void memoryPerRoute();
+};
+
+void TestRouteTable::insertAndFind() {
+    RouteTable table;
+    QCOMPARE(table.find("a"), RouteTable::NoRoute);
+    RouteTable::Handle a = table.insert("a");
+    table.at(a).cost = 3;
+    QCOMPARE(table.insert("a"), a);
+    QCOMPARE(table.find("a"), a);
+    QCOMPARE(table.at(table.find("a")).cost, (short)3);
+    QVERIFY(table.contains("a"));
+    QVERIFY(!table.contains("b"));
+    QCOMPARE(table.size(), 1);
+}
+
+void TestRouteTable::handlesSurviveGrowth() {
+    RouteTable table;
+    QStringList addresses = makeAddresses(1000);
+    QVector<RouteTable::Handle> handles;
+    for (const QString& address : addresses)
+        handles.append(table.insert(address));
+    for (int i = 0; i < addresses.size(); i++) {
+        QCOMPARE(table.find(addresses.at(i)), handles.at(i));
+        QCOMPARE(table.at(handles.at(i)).address, addresses.at(i));
+    }
+    QCOMPARE(table.size(), addresses.size());
+}
+
+void TestRouteTable::removeKeepsProbeRuns() {
+    RouteTable table;
+    QStringList addresses = makeAddresses(1000);
+    for (const QString& address : addresses)
+        table.insert(address);
+    for (int i = 0; i < addresses.size(); i += 2)
+        QVERIFY(table.remove(addresses.at(i)));
+    QVERIFY(!table.remove(addresses.at(0)));
+    for (int i = 0; i < addresses.size(); i++)
+        QCOMPARE(table.contains(addresses.at(i)), i % 2 == 1);
+    QCOMPARE(table.size(), addresses.size() / 2);
+    QCOMPARE(table.addresses().size(), addresses.size() / 2);
+    QCOMPARE(table.handles().size(), addresses.size() / 2);
+}
+
+void TestRouteTable::removedHandlesAreReused() {
+    RouteTable table;
+    table.insert("a");
+    RouteTable::Handle b = table.insert("b");
+    table.at(b).cost = 2;
+    table.remove(b);
+    RouteTable::Handle c = table.insert("c");
+    QCOMPARE(c, b);
+    QCOMPARE(table.at(c).address, QString("c"));
+    QCOMPARE(table.at(c).cost, (short)0);
+}
+
+void TestRouteTable::clearReleasesMemory() {
+    RouteTable table;
+    qint64 empty = table.memoryUsage();
+    for (const QString& address : makeAddresses(10000))
+        table.insert(address);
+    QVERIFY(table.memoryUsage() > empty);
+    table.clear();
+    QCOMPARE(table.size(), 0);
+    QCOMPARE(table.memoryUsage(), empty);
+}
+
+void TestRouteTable::lookup_data() {
+    QTest::addColumn<int>("routes");
+    QTest::newRow("100") << 100;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+// lookup finds every route once per iteration
+void TestRouteTable::lookup() {
+    QFETCH(int, routes);
+    QStringList addresses = makeAddresses(routes);
+    RouteTable table;
+    for (const QString& address : addresses)
+        table.insert(address);
+    int found = 0;
+    QBENCHMARK {
+        for (const QString& address : addresses)
+            found += table.find(address) != RouteTable::NoRoute;
+    }
+    QVERIFY(found > 0);
+}
+
+void TestRouteTable::lookupQHash_data() {
+    lookup_data();
+}
+
+// lookupQHash is the baseline for lookup: a QHash of heap-allocated entries
+void TestRouteTable::lookupQHash() {
+    QFETCH(int, routes);
+    QStringList addresses = makeAddresses(routes);
+    QHash<QString, RouteEntry*> table;
+    for (const QString& address : addresses)
+        table.insert(address, new RouteEntry());
+    int found = 0;
+    QBENCHMARK {
+        for (const QString& address : addresses)
+            found += table.value(address) != nullptr;
+    }
+    QVERIFY(found > 0);
+    qDeleteAll(table);
+}
+
+void TestRouteTable::memoryPerRoute_data() {
+    lookup_data();
+}
+
+// memoryPerRoute reports the bytes the table holds per route, excluding the
+// address strings
+void TestRouteTable::memoryPerRoute() {
+    QFETCH(int, routes);
+    RouteTable table;
+    for (const QString& address : makeAddresses(routes))
+        table.insert(address);
+    QTest::setBenchmarkResult((qreal)table.memoryUsage() / routes, QTest::BytesAllocated);
+}
+
+QTEST_APPLESS_MAIN(TestRouteTable)
+
+#include "tst_routetable.moc"
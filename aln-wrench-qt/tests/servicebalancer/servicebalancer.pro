@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_servicebalancer
+
+SOURCES += \
+    $$ALN/servicebalancer.cpp \
+    tst_servicebalancer.cpp
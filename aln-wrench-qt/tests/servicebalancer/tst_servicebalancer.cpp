@@ -0,0 +1,79 @@
+#include <QtTest>
+#include "servicebalancer.h"
+
+class TestServiceBalancer : public QObject {
+    Q_OBJECT
+
+private slots:
+    void noInstance();
+    void spread_data();
+    void spread();
+    void choose_data();
+    void choose();
+};
+
+void TestServiceBalancer::noInstance() {
+    for (int policy = ServiceBalancer::LeastLoaded; policy <= ServiceBalancer::Affinity; policy++)
+        QCOMPARE(ServiceBalancer::choose((ServiceBalancer::Policy)policy, QVector<short>(), QVector<int>()), -1);
+}
+
+void TestServiceBalancer::spread_data() {
+    QTest::addColumn<int>("policy");
+    QTest::addColumn<QVector<double>>("shares");
+    QTest::newRow("least loaded") << (int)ServiceBalancer::LeastLoaded << QVector<double>({1, 0, 0, 0});
+    // the lower of two distinct instances: each wins the pairs with the more loaded ones
+    QTest::newRow("power of two choices") << (int)ServiceBalancer::PowerOfTwoChoices << QVector<double>({3 / 6.0, 2 / 6.0, 1 / 6.0, 0});
+    QTest::newRow("weighted random") << (int)ServiceBalancer::WeightedRandom << QVector<double>({8 / 15.0, 4 / 15.0, 2 / 15.0, 1 / 15.0});
+    // no request is answered, so each goes to the instance with the fewest in flight
+    QTest::newRow("least outstanding") << (int)ServiceBalancer::LeastOutstanding << QVector<double>({0.25, 0.25, 0.25, 0.25});
+    QTest::newRow("affinity") << (int)ServiceBalancer::Affinity << QVector<double>({1, 0, 0, 0});
+}
+
+// spread makes 10000 choices among instances loaded 1, 2, 4 and 8 and checks
+// the share of the choices each instance gets
+void TestServiceBalancer::spread() {
+    QFETCH(int, policy);
+    QFETCH(QVector<double>, shares);
+    QRandomGenerator random(1);
+    QVector<short> loads({1, 2, 4, 8});
+    QVector<int> outstanding(loads.size(), 0);
+    QVector<int> chosen(loads.size(), 0);
+    for (int i = 0; i < 10000; i++) {
+        int instance = ServiceBalancer::choose((ServiceBalancer::Policy)policy, loads, outstanding, &random);
+        QVERIFY(instance >= 0 && instance < loads.size());
+        chosen[instance]++;
+        outstanding[instance]++;
+    }
+    for (int i = 0; i < loads.size(); i++)
+        QVERIFY2(qAbs(chosen.at(i) / 10000.0 - shares.at(i)) < 0.02, qPrintable(QString("instance %1 chosen %2 times").arg(i).arg(chosen.at(i))));
+}
+
+void TestServiceBalancer::choose_data() {
+    QTest::addColumn<int>("policy");
+    QTest::newRow("least loaded") << (int)ServiceBalancer::LeastLoaded;
+    QTest::newRow("power of two choices") << (int)ServiceBalancer::PowerOfTwoChoices;
+    QTest::newRow("weighted random") << (int)ServiceBalancer::WeightedRandom;
+    QTest::newRow("least outstanding") << (int)ServiceBalancer::LeastOutstanding;
+}
+
+// choose makes 1000 choices among 64 instances
+void TestServiceBalancer::choose() {
+    QFETCH(int, policy);
+    QRandomGenerator random(1);
+    QVector<short> loads;
+    QVector<int> outstanding;
+    for (int i = 0; i < 64; i++) {
+        loads.append(1 + i % 16);
+        outstanding.append(i % 5);
+    }
+    int sum = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++)
+            sum += ServiceBalancer::choose((ServiceBalancer::Policy)policy, loads, outstanding, &random);
+    }
+    QVERIFY(sum >= 0);
+}
+
+QTEST_APPLESS_MAIN(TestServiceBalancer)
+
+#include "tst_servicebalancer.moc"
@@ -0,0 +1,27 @@
+include(../tests.pri)
+
+TARGET = tst_serviceexecutor
+
+SOURCES += \
+    $$ALN/alntypes.cpp \
+    $$ALN/channel.cpp \
+    $$ALN/contexttable.cpp \
+    $$ALN/floodfilter.cpp \
+    $$ALN/hashring.cpp \
+    $$ALN/latencywindow.cpp \
+    $$ALN/localchannel.cpp \
+    $$ALN/outlierdetector.cpp \
+    $$ALN/packet.cpp \
+    $$ALN/pendingqueue.cpp \
+    $$ALN/responsecache.cpp \
+    $$ALN/router.cpp \
+    $$ALN/routetable.cpp \
+    $$ALN/servicebalancer.cpp \
+    $$ALN/serviceexecutor.cpp \
+    $$ALN/servicetable.cpp \
+    tst_serviceexecutor.cpp
+
+HEADERS += \
+    $$ALN/channel.h \
+    $$ALN/localchannel.h \
+    $$ALN/router.h
@@ -0,0 +1,167 @@
+#include <QtTest>
+#include "packet.h"
+#include "router.h"
+#include "serviceexecutor.h"
+
+// RecordingHandler keeps the data of each packet it handles, in order; while
+// closed, calls wait for open
+class RecordingHandler : public PacketHandler {
+public:
+    QMutex mutex;
+    QWaitCondition opened;
+    bool closed = false;
+    QList<QByteArray> handled;
+
+    void onPacket(Packet* p) override {
+        QMutexLocker lock(&mutex);
+        while (closed)
+            opened.wait(&mutex);
+        handled.append(p->data);
+    }
+    void close() {
+        QMutexLocker lock(&mutex);
+        closed = true;
+    }
+    void open() {
+        QMutexLocker lock(&mutex);
+        closed = false;
+        opened.wakeAll();
+    }
+    QList<QByteArray> flow(QString source) {
+        QMutexLocker lock(&mutex);
+        QList<QByteArray> packets;
+        foreach (QByteArray data, handled) {
+            if (data.startsWith(source.toUtf8()))
+                packets.append(data);
+        }
+        return packets;
+    }
+};
+
+// packet returns the n-th packet of the flow from source, numbered in its data
+static Packet* packet(QString source, int n) {
+    Packet* p = new Packet("A", "service", 1, QString("%1 %2").arg(source).arg(n).toUtf8());
+    p->srcAddress = source;
+    return p;
+}
+
+// waitUntilRunning returns once every packet posted to executor has been taken
+// by one of count running handler calls
+static void waitUntilRunning(ServiceExecutor* executor, int count) {
+    while (executor->running() < count || executor->queued() > 0)
+        QThread::yieldCurrentThread();
+}
+
+class TestServiceExecutor : public QObject {
+    Q_OBJECT
+private slots:
+    void directCall();
+    void flowsKeepOrder();
+    void rejectWhenFull();
+    void dropOldestWhenFull();
+    void post_data();
+    void post();
+};
+
+void TestServiceExecutor::directCall() {
+    QThreadPool pool;
+    RecordingHandler handler;
+    std::shared_ptr<ServiceExecutor> executor = std::make_shared<ServiceExecutor>("service", &handler, &pool, 0, 1, ServiceExecutor::Reject);
+    QCOMPARE(executor->post(packet("B", 0)), QString());
+    QCOMPARE(handler.handled, QList<QByteArray>({"B 0"}));
+    QCOMPARE(executor->running(), 0);
+    QCOMPARE(executor->queued(), 0);
+    QVERIFY(executor->latency() >= 0);
+}
+
+// flowsKeepOrder posts the packets of four flows to four workers; each flow is
+// handled in the order it was posted
+void TestServiceExecutor::flowsKeepOrder() {
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    RecordingHandler handler;
+    std::shared_ptr<ServiceExecutor> executor = std::make_shared<ServiceExecutor>("service", &handler, &pool, 4, 1000, ServiceExecutor::Reject);
+    QStringList sources({"B", "C", "D", "E"});
+    for (int n = 0; n < 100; n++) {
+        foreach (QString source, sources)
+            QCOMPARE(executor->post(packet(source, n)), QString());
+    }
+    pool.waitForDone();
+    QCOMPARE(handler.handled.size(), 400);
+    foreach (QString source, sources) {
+        QList<QByteArray> flow = handler.flow(source);
+        QCOMPARE(flow.size(), 100);
+        for (int n = 0; n < 100; n++)
+            QCOMPARE(flow.at(n), QString("%1 %2").arg(source).arg(n).toUtf8());
+    }
+    QCOMPARE(executor->dropped(), (qint64)0);
+}
+
+// rejectWhenFull keeps the only worker busy; beyond two waiting packets a new
+// one is refused
+void TestServiceExecutor::rejectWhenFull() {
+    QThreadPool pool;
+    RecordingHandler handler;
+    std::shared_ptr<ServiceExecutor> executor = std::make_shared<ServiceExecutor>("service", &handler, &pool, 1, 2, ServiceExecutor::Reject);
+    handler.close();
+    QCOMPARE(executor->post(packet("B", 0)), QString());
+    waitUntilRunning(executor.get(), 1);
+    QCOMPARE(executor->post(packet("B", 1)), QString());
+    QCOMPARE(executor->post(packet("C", 0)), QString());
+    QVERIFY(!executor->post(packet("C", 1)).isEmpty());
+    QCOMPARE(executor->queued(), 2);
+    QCOMPARE(executor->dropped(), (qint64)1);
+
+    handler.open();
+    pool.waitForDone();
+    QCOMPARE(handler.handled, QList<QByteArray>({"B 0", "C 0", "B 1"}));
+    QCOMPARE(executor->running(), 0);
+    QCOMPARE(executor->queued(), 0);
+}
+
+// dropOldestWhenFull makes room for a new packet by dropping the head of the
+// longest waiting flow
+void TestServiceExecutor::dropOldestWhenFull() {
+    QThreadPool pool;
+    RecordingHandler handler;
+    std::shared_ptr<ServiceExecutor> executor = std::make_shared<ServiceExecutor>("service", &handler, &pool, 1, 2, ServiceExecutor::DropOldest);
+    handler.close();
+    QCOMPARE(executor->post(packet("B", 0)), QString());
+    waitUntilRunning(executor.get(), 1);
+    QCOMPARE(executor->post(packet("C", 0)), QString());
+    QCOMPARE(executor->post(packet("D", 0)), QString());
+    QCOMPARE(executor->post(packet("E", 0)), QString());
+    QCOMPARE(executor->queued(), 2);
+    QCOMPARE(executor->dropped(), (qint64)1);
+
+    handler.open();
+    pool.waitForDone();
+    QCOMPARE(handler.handled, QList<QByteArray>({"B 0", "D 0", "E 0"}));
+}
+
+void TestServiceExecutor::post_data() {
+    QTest::addColumn<int>("workers");
+    QTest::newRow("direct") << 0;
+    QTest::newRow("1 worker") << 1;
+    QTest::newRow("4 workers") << 4;
+}
+
+// post hands 1000 packets of 10 flows to the handler and waits for it to
+// handle them all
+void TestServiceExecutor::post() {
+    QFETCH(int, workers);
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(workers, 1));
+    RecordingHandler handler;
+    std::shared_ptr<ServiceExecutor> executor = std::make_shared<ServiceExecutor>("service", &handler, &pool, workers, 1000, ServiceExecutor::Reject);
+    QBENCHMARK {
+        for (int n = 0; n < 1000; n++)
+            executor->post(packet(QString("node-%1").arg(n % 10), n));
+        pool.waitForDone();
+    }
+    QCOMPARE(executor->dropped(), (qint64)0);
+}
+
+QTEST_GUILESS_MAIN(TestServiceExecutor)
+
+#include "tst_serviceexecutor.moc"
@@ -0,0 +1,7 @@
+include(../tests.pri)
+
+TARGET = tst_servicetable
+
+SOURCES += \
+    $$ALN/servicetable.cpp \
+    tst_servicetable.cpp
@@ -0,0 +1,135 @@
+#include <QtTest>
+#include "servicetable.h"
+
+class TestServiceTable : public QObject {
+    Q_OBJECT
+
+private slots:
+    void orderedByLoad();
+    void updateMovesHost();
+    void unchangedLoadRefreshes();
+    void zeroLoadRemoves();
+    void servicesOfAddress();
+    void removeAddress();
+    void leastLoaded_data();
+    void leastLoaded();
+    void loadUpdates_data();
+    void loadUpdates();
+};
+
+void TestServiceTable::orderedByLoad() {
+    ServiceTable table;
+    QVERIFY(table.update("echo", "b", 3));
+    QVERIFY(table.update("echo", "a", 5));
+    QVERIFY(table.update("echo", "c", 1));
+    QCOMPARE(table.addresses("echo"), QStringList({"c", "b", "a"}));
+    QCOMPARE(table.loads("echo"), QVector<short>({1, 3, 5}));
+    QCOMPARE(table.leastLoaded("echo"), QString("c"));
+    QCOMPARE(table.leastLoaded("log"), QString());
+    QCOMPARE(table.services(), QStringList({"echo"}));
+}
+
+void TestServiceTable::updateMovesHost() {
+    ServiceTable table;
+    table.update("echo", "a", 1);
+    table.update("echo", "b", 2);
+    QVERIFY(table.update("echo", "a", 4));
+    QCOMPARE(table.addresses("echo"), QStringList({"b", "a"}));
+    QCOMPARE(table.leastLoaded("echo"), QString("b"));
+    QCOMPARE(table.find("echo", "a")->capacity, (short)4);
+}
+
+void TestServiceTable::unchangedLoadRefreshes() {
+    ServiceTable table;
+    table.update("echo", "a", 2, 100, 4);
+    QVERIFY(!table.update("echo", "a", 2, 200, 6));
+    const NodeCapacity* capacity = table.find("echo", "a");
+    QVERIFY(capacity);
+    QCOMPARE(capacity->lastSeen, (qint64)200);
+    QCOMPARE(capacity->seq, (INT16U)6);
+}
+
+void TestServiceTable::zeroLoadRemoves() {
+    ServiceTable table;
+    table.update("echo", "a", 2);
+    table.update("echo", "b", 3);
+    QVERIFY(table.update("echo", "a", 0));
+    QCOMPARE(table.addresses("echo"), QStringList({"b"}));
+    QVERIFY(!table.update("echo", "a", 0));
+    QVERIFY(table.remove("echo", "b"));
+    QVERIFY(!table.contains("echo"));
+    QVERIFY(!table.find("echo"));
+}
+
+void TestServiceTable::servicesOfAddress() {
+    ServiceTable table;
+    table.update("echo", "a", 1);
+    table.update("log", "a", 2);
+    table.update("echo", "b", 1);
+    QStringList services = table.services("a");
+    services.sort();
+    QCOMPARE(services, QStringList({"echo", "log"}));
+    table.remove("log", "a");
+    QCOMPARE(table.services("a"), QStringList({"echo"}));
+    table.update("echo", "a", 0);
+    QVERIFY(table.services("a").isEmpty());
+    QCOMPARE(table.services("b"), QStringList({"echo"}));
+}
+
+void TestServiceTable::removeAddress() {
+    ServiceTable table;
+    table.update("echo", "a", 1);
+    table.update("log", "a", 2);
+    table.update("echo", "b", 3);
+    table.removeAddress("a");
+    QVERIFY(table.services("a").isEmpty());
+    QVERIFY(!table.contains("log"));
+    QCOMPARE(table.addresses("echo"), QStringList({"b"}));
+    QCOMPARE(table.leastLoaded("echo"), QString("b"));
+    table.removeAddress("c");
+    QCOMPARE(table.services(), QStringList({"echo"}));
+}
+
+void TestServiceTable::leastLoaded_data() {
+    QTest::addColumn<int>("instances");
+    QTest::newRow("10") << 10;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+}
+
+// leastLoaded selects the least loaded of many instances of one service
+void TestServiceTable::leastLoaded() {
+    QFETCH(int, instances);
+    ServiceTable table;
+    for (int i = 0; i < instances; i++)
+        table.update("echo", QString("node-%1").arg(i), 1 + i % 100);
+    QString selected;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++)
+            selected = table.leastLoaded("echo");
+    }
+    QCOMPARE(selected, QString("node-0"));
+}
+
+void TestServiceTable::loadUpdates_data() {
+    leastLoaded_data();
+}
+
+// loadUpdates moves instances through the load order as advertisements arrive
+void TestServiceTable::loadUpdates() {
+    QFETCH(int, instances);
+    ServiceTable table;
+    for (int i = 0; i < instances; i++)
+        table.update("echo", QString("node-%1").arg(i), 1 + i % 100);
+    QStringList addresses = table.addresses("echo");
+    int load = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++)
+            table.update("echo", addresses.at(i % instances), 1 + load++ % 100);
+    }
+    QCOMPARE(table.addresses("echo").size(), instances);
+}
+
+QTEST_APPLESS_MAIN(TestServiceTable)
+
+#include "tst_servicetable.moc"
@@ -0,0 +1,10 @@
+# shared setup of the unit tests and benchmarks of the aln library; each test
+# lists the library sources it needs. Run them with `make check`.
+QT       += testlib
+QT       -= gui
+
+CONFIG += c++17 console testcase no_testcase_installs
+CONFIG -= app_bundle
+
+ALN = $$PWD/../aln
+INCLUDEPATH += $$ALN
@@ -0,0 +1,16 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    contexttable \
+    floodfilter \
+    hashring \
+    latencywindow \
+    outlierdetector \
+    pendingqueue \
+    responsecache \
+    router \
+    routetable \
+    servicebalancer \
+    serviceexecutor \
+    servicetable \
+    timerwheel
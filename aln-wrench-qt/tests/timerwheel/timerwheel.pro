@@ -0,0 +1,9 @@
+include(../tests.pri)
+
+TARGET = tst_timerwheel
+
+SOURCES += \
+    tst_timerwheel.cpp
+
+HEADERS += \
+    $$ALN/timerwheel.h
@@ -0,0 +1,117 @@
+#include <QtTest>
+#include "timerwheel.h"
+
+class TestTimerWheel : public QObject {
+    Q_OBJECT
+
+private slots:
+    void firesAtDeadline();
+    void roundsUpToTick();
+    void pastDeadlineFiresNext();
+    void cascadesAcrossLevels_data();
+    void cascadesAcrossLevels();
+    void clampsBeyondRange();
+    void startsAtNow();
+    void scheduleAndExpire_data();
+    void scheduleAndExpire();
+    void idleTicks();
+};
+
+void TestTimerWheel::firesAtDeadline() {
+    TimerWheel<int> wheel(100);
+    wheel.schedule(300, 1);
+    wheel.schedule(500, 2);
+    QCOMPARE(wheel.size(), 2);
+    QVERIFY(wheel.advance(299).isEmpty());
+    QCOMPARE(wheel.advance(300), QList<int>({1}));
+    QVERIFY(wheel.advance(499).isEmpty());
+    QCOMPARE(wheel.advance(1000), QList<int>({2}));
+    QCOMPARE(wheel.size(), 0);
+}
+
+void TestTimerWheel::roundsUpToTick() {
+    TimerWheel<int> wheel(100);
+    wheel.schedule(250, 1);
+    QVERIFY(wheel.advance(299).isEmpty());
+    QCOMPARE(wheel.advance(300), QList<int>({1}));
+}
+
+void TestTimerWheel::pastDeadlineFiresNext() {
+    TimerWheel<int> wheel(100);
+    QVERIFY(wheel.advance(1000).isEmpty());
+    wheel.schedule(200, 1);
+    QCOMPARE(wheel.advance(1100), QList<int>({1}));
+}
+
+void TestTimerWheel::cascadesAcrossLevels_data() {
+    QTest::addColumn<qint64>("ticks");
+    QTest::newRow("level 0") << (qint64)63;
+    QTest::newRow("level 1") << (qint64)64;
+    QTest::newRow("level 2") << (qint64)(64 * 64 + 5);
+    QTest::newRow("level 3") << (qint64)(64 * 64 * 64 + 7);
+}
+
+// cascadesAcrossLevels checks that a timer placed on a coarse level still fires
+// on its own tick, neither earlier nor later
+void TestTimerWheel::cascadesAcrossLevels() {
+    QFETCH(qint64, ticks);
+    TimerWheel<int> wheel(1, 3);
+    wheel.schedule(3 + ticks, 1);
+    QVERIFY(wheel.advance(3 + ticks - 1).isEmpty());
+    QCOMPARE(wheel.advance(3 + ticks), QList<int>({1}));
+}
+
+void TestTimerWheel::clampsBeyondRange() {
+    TimerWheel<int> wheel(1);
+    qint64 range = (qint64)1 << 24;
+    wheel.schedule(range * 2, 1);
+    QVERIFY(wheel.advance(range * 2 - 1).isEmpty());
+    QCOMPARE(wheel.advance(range * 2), QList<int>({1}));
+}
+
+void TestTimerWheel::startsAtNow() {
+    TimerWheel<int> wheel(100, 10000);
+    wheel.schedule(10100, 1);
+    QCOMPARE(wheel.advance(10100), QList<int>({1}));
+}
+
+void TestTimerWheel::scheduleAndExpire_data() {
+    QTest::addColumn<int>("timers");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("100k") << 100000;
+}
+
+// scheduleAndExpire schedules timers spread over a minute of 250 ms ticks, as
+// route expiry does, and advances the wheel past all of them
+void TestTimerWheel::scheduleAndExpire() {
+    QFETCH(int, timers);
+    int fired = 0;
+    QBENCHMARK {
+        TimerWheel<int> wheel(250);
+        for (int i = 0; i < timers; i++)
+            wheel.schedule((i * 7919) % 60000, i);
+        fired = 0;
+        for (qint64 now = 0; now <= 60000; now += 50)
+            fired += wheel.advance(now).size();
+    }
+    QCOMPARE(fired, timers);
+}
+
+// idleTicks advances a wheel holding a few distant timers, the cost of the
+// expiry timer between route refreshes
+void TestTimerWheel::idleTicks() {
+    int pending = 0;
+    QBENCHMARK {
+        TimerWheel<int> wheel(250);
+        for (int i = 0; i < 16; i++)
+            wheel.schedule(3600 * 1000 + i, i);
+        for (qint64 now = 0; now < 50000; now += 50)
+            wheel.advance(now);
+        pending = wheel.size();
+    }
+    QCOMPARE(pending, 16);
+}
+
+QTEST_APPLESS_MAIN(TestTimerWheel)
+
+#include "tst_timerwheel.moc"
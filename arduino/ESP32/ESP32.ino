@@ -5,6 +5,7 @@ ESP32 demo of streaming internal temperature sensor data to an ALN hub
 #include <AsyncUDP.h>
 #include "parser.h"
 #include "framer.h"
+#include "telemetry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,13 +32,14 @@ char nodeRouteData[] = "\x08" "ESP32-black-box\x0001";
 uint8 nodeRouteDataSz = 18;
 
 char srv[] = "log";
-char data[16];
 float value;
-int dataSz;
 
 void handler(Packet* p);
 Parser parser(handler);
 
+void sendTelemetry(uint8* data, uint16 sz);
+TelemetryBatch telemetry(sendTelemetry);
+
 // measure elapsed time
 int timerMark = 0;
 void markTime() {
@@ -59,6 +61,17 @@ void sendPacket(Packet* p) {
   f.end();
 }
 
+// sendTelemetry delivers a batch of readings to the log service
+void sendTelemetry(uint8* data, uint16 sz) {
+  Packet p;
+  p.clear();
+  p.setService((uint8*)srv, 3);
+  p.setSource((uint8*)nodeAddress, nodeAdressSize);
+  p.typ = TELEMETRY_DATATYPE;
+  p.setData(data, sz);
+  sendPacket(&p);
+}
+
 void handler(Packet* p) {
   if (p->net == NET_QUERY) {
     char buffer[14];
@@ -105,6 +118,8 @@ void setup() {
     delay(500);
   }
   Serial.println(WiFi.localIP());
+  telemetry.setFlushInterval(120000); // report at least every two minutes
+  telemetry.setThreshold(1.0);        // or as soon as the temperature moves a degree
   udp.listen(udpBroadcastListenPort);
   udp.onPacket([](AsyncUDPPacket packet) {
     if (client.connected()){
@@ -153,16 +168,11 @@ void loop() {
       }
       if (elapsed() > 2000) {
         value = readSensor();
-        dataSz = sprintf(data, "%0.2f*F", value);
-        Serial.println(data); delay(10);
-        Packet p;
-        p.clear();
-        p.setService((uint8*)srv, 3);
-        p.setSource((uint8*)nodeAddress, nodeAdressSize);
-        p.setData((uint8*)data, dataSz);
-        sendPacket(&p);
+        Serial.println(value);
+        telemetry.append(millis(), value);
         markTime();
       }
+      telemetry.poll(millis());
   }
   if (elapsed() < 0) {
     Serial.println("timer rollover detected, reseting timer");
@@ -1,9 +1,12 @@
 #include "ArduinoBLESerial.h"
+#include "utility/ATT.h"
 
 ArduinoBLESerial::ArduinoBLESerial() {
   this->numAvailableLines = 0;
-  this->transmitBufferLength = 0;
   this->lastFlushTime = 0;
+  this->mtu = BLE_ATT_DEFAULT_MTU;
+  this->mtuOverride = 0;
+  this->queuedFrameBytes = 0;
 
 
   this->transmitCharacteristic.addDescriptor(txDescriptor);
@@ -23,11 +26,12 @@ void ArduinoBLESerial::addService() {
   uartService.addCharacteristic(receiveCharacteristic);
   uartService.addCharacteristic(transmitCharacteristic);
   receiveCharacteristic.setEventHandler(BLEWritten, ArduinoBLESerial::onBLEWritten);
+  BLE.setEventHandler(BLEConnected, ArduinoBLESerial::onBLEConnected);
   BLE.addService(uartService);
 }
 
 void ArduinoBLESerial::poll() {
-  if (millis() - this->lastFlushTime > 100) {
+  if (millis() - this->lastFlushTime > BLE_SERIAL_FLUSH_INTERVAL) {
     flush();
   } else {
     BLE.poll();
@@ -38,6 +42,9 @@ void ArduinoBLESerial::end() {
   this->receiveCharacteristic.setEventHandler(BLEWritten, NULL);
   this->receiveBuffer.clear();
   flush();
+  this->transmitBuffer.clear();
+  this->queuedFrameBytes = 0;
+  this->mtu = BLE_ATT_DEFAULT_MTU;
 }
 
 size_t ArduinoBLESerial::available() {
@@ -45,40 +52,134 @@ size_t ArduinoBLESerial::available() {
 }
 
 int ArduinoBLESerial::read(uint8_t* buff, int sz) {
-  if (available() < sz)
-    sz = available();
-  for(int i=0; i< sz; i++)
-    buff[i] = this->receiveBuffer.pop();
-  return sz;
+  if (sz <= 0)
+    return 0;
+  return this->receiveBuffer.read(buff, sz);
 }
 
 size_t ArduinoBLESerial::write(uint8_t byte) {
   if (this->transmitCharacteristic.subscribed() == false) {
     return 0;
   }
-  this->transmitBuffer[this->transmitBufferLength] = byte;
-  this->transmitBufferLength ++;
-  if (this->transmitBufferLength == sizeof(this->transmitBuffer)) {
-      flush();
+  if (!this->transmitBuffer.add(byte)) {
+    sendNotifications(true);
+    this->transmitBuffer.add(byte);
   }
+  if (byte == BLE_SERIAL_FRAME_END) {
+    this->queuedFrameBytes = this->transmitBuffer.getLength();
+  }
+  sendNotifications(false);
   return 1;
 }
 
 size_t ArduinoBLESerial::write(uint8_t* buff, int sz) {
-  for(int i =0; i <sz; i++)
-    write(buff[i]);
+  if (this->transmitCharacteristic.subscribed() == false || sz <= 0) {
+    return 0;
+  }
+  size_t total = 0;
+  while (total < (size_t)sz) {
+    size_t n = this->transmitBuffer.write(buff + total, sz - total);
+    if (n == 0) {
+      sendNotifications(true);
+      continue;
+    }
+    // bytes up to the last frame delimiter are ready to go out
+    for (size_t i = n; i > 0; i--) {
+      if (buff[total + i - 1] == BLE_SERIAL_FRAME_END) {
+        this->queuedFrameBytes = this->transmitBuffer.getLength() - (n - i);
+        break;
+      }
+    }
+    total += n;
+    sendNotifications(false);
+  }
   return sz;
 }
 
 void ArduinoBLESerial::flush() {
-  if (this->transmitBufferLength > 0) {
-    this->transmitCharacteristic.setValue(this->transmitBuffer, this->transmitBufferLength);
-    this->transmitBufferLength = 0;
-  }
+  refreshMtu();
+  sendNotifications(true);
   this->lastFlushTime = millis();
   BLE.poll();
 }
 
+void ArduinoBLESerial::setMtu(uint16_t mtu) {
+  this->mtuOverride = mtu;
+  refreshMtu();
+}
+
+// applyMtu clamps mtu to the sizes the notification buffer supports
+void ArduinoBLESerial::applyMtu(uint16_t mtu) {
+  if (mtu < BLE_ATT_DEFAULT_MTU)
+    mtu = BLE_ATT_DEFAULT_MTU;
+  if (mtu > BLE_SERIAL_MAX_MTU)
+    mtu = BLE_SERIAL_MAX_MTU;
+  this->mtu = mtu;
+}
+
+// connectionHandle returns the ATT handle of the link to central, or 0xffff.
+// BLEDevice reports its address as text, most significant byte first, while
+// ATT keeps it as bytes, least significant first.
+static uint16_t connectionHandle(BLEDevice& central) {
+  String text = central.address();
+  if (text.length() < 17)
+    return 0xffff;
+  uint8_t address[6];
+  for (int i = 0; i < 6; i++)
+    address[5 - i] = strtoul(text.substring(3 * i, 3 * i + 2).c_str(), NULL, 16);
+  return ATT.connectionHandle(central.addressType(), address);
+}
+
+// refreshMtu reads the MTU negotiated with the connected central from the ATT
+// layer. The central may exchange MTUs some time after connecting, so this runs
+// on connect and again on every flush.
+void ArduinoBLESerial::refreshMtu() {
+  if (this->mtuOverride != 0) {
+    applyMtu(this->mtuOverride);
+    return;
+  }
+  BLEDevice central = BLE.central();
+  uint16_t handle = central ? connectionHandle(central) : 0xffff;
+  if (handle == 0xffff) {
+    applyMtu(BLE_ATT_DEFAULT_MTU);
+    return;
+  }
+  applyMtu(ATT.mtu(handle));
+}
+
+uint16_t ArduinoBLESerial::getMtu() {
+  return this->mtu;
+}
+
+size_t ArduinoBLESerial::payloadSize() {
+  return this->mtu - BLE_ATT_HEADER_SIZE;
+}
+
+// sendNotifications emits every full notification in the transmit buffer; the
+// remainder goes out early if it ends a queued frame or partial is set
+void ArduinoBLESerial::sendNotifications(bool partial) {
+  size_t payload = payloadSize();
+  size_t length = this->transmitBuffer.getLength();
+  while (length >= payload || (length > 0 && (partial || this->queuedFrameBytes > 0))) {
+    size_t n = min(length, payload);
+    notify(n);
+    this->queuedFrameBytes = this->queuedFrameBytes > n ? this->queuedFrameBytes - n : 0;
+    length -= n;
+  }
+}
+
+// notify sends the oldest sz bytes, straight from the ring when they are contiguous
+void ArduinoBLESerial::notify(size_t sz) {
+  const uint8_t* span;
+  if (this->transmitBuffer.readSpan(&span) >= sz) {
+    this->transmitCharacteristic.setValue(span, sz);
+    this->transmitBuffer.consume(sz);
+  } else {
+    this->transmitBuffer.read(this->notification, sz);
+    this->transmitCharacteristic.setValue(this->notification, sz);
+  }
+}
+
 bool ArduinoBLESerial::connected() {
   return BLE.connected();
 }
@@ -88,8 +189,8 @@ ArduinoBLESerial::operator bool() {
 }
 
 void ArduinoBLESerial::onReceive(const uint8_t* data, size_t size) {
-  for (size_t i = 0; i < min(size, sizeof(this->receiveBuffer)); i++) {
-    this->receiveBuffer.add(data[i]);
+  size_t n = this->receiveBuffer.write(data, size);
+  for (size_t i = 0; i < n; i++) {
     if (data[i] == '\n') {
       this->numAvailableLines ++;
     }
@@ -99,3 +200,7 @@ void ArduinoBLESerial::onReceive(const uint8_t* data, size_t size) {
 void ArduinoBLESerial::onBLEWritten(BLEDevice central, BLECharacteristic characteristic) {
   ArduinoBLESerial::getInstance().onReceive(characteristic.value(), characteristic.valueLength());
 }
+
+void ArduinoBLESerial::onBLEConnected(BLEDevice central) {
+  ArduinoBLESerial::getInstance().refreshMtu();
+}
@@ -14,40 +14,18 @@ Tested using UART console feature in [Adafruit Bluefruit LE Connect](https://app
 #include <Arduino.h>
 #include <ArduinoBLE.h>
 
-#define BLE_ATTRIBUTE_MAX_VALUE_LENGTH 20
-#define BLE_SERIAL_RECEIVE_BUFFER_SIZE 256
+#include "ByteRingBuffer.h"
 
-template<size_t N> class ByteRingBuffer {
-  private:
-    uint8_t ringBuffer[N];
-    size_t newestIndex = 0;
-    size_t length = 0;
-  public:
-    void add(uint8_t value) {
-      ringBuffer[newestIndex] = value;
-      newestIndex = (newestIndex + 1) % N;
-      length = min(length + 1, N);
-    }
-    int pop() { // pops the oldest value off the ring buffer
-      if (length == 0) {
-        return -1;
-      }
-      uint8_t result = ringBuffer[(N + newestIndex - length) % N];
-      length -= 1;
-      return result;
-    }
-    void clear() {
-      newestIndex = 0;
-      length = 0;
-    }
-    int get(size_t index) { // this.get(0) is the oldest value, this.get(this.getLength() - 1) is the newest value
-      if (index < 0 || index >= length) {
-        return -1;
-      }
-      return ringBuffer[(N + newestIndex - length + index) % N];
-    }
-    size_t getLength() { return length; }
-};
+#define BLE_ATT_HEADER_SIZE 3   // opcode and handle preceding each notification payload
+#define BLE_ATT_DEFAULT_MTU 23  // MTU before an exchange; 20 bytes of payload
+#ifndef BLE_SERIAL_MAX_MTU
+#define BLE_SERIAL_MAX_MTU 247  // largest MTU that fits one data-length-extended link layer PDU
+#endif
+#define BLE_ATTRIBUTE_MAX_VALUE_LENGTH (BLE_SERIAL_MAX_MTU - BLE_ATT_HEADER_SIZE)
+#define BLE_SERIAL_RECEIVE_BUFFER_SIZE 256   // power of two
+#define BLE_SERIAL_TRANSMIT_BUFFER_SIZE 1024 // power of two
+#define BLE_SERIAL_FLUSH_INTERVAL 100        // ms before a partial notification is sent
+#define BLE_SERIAL_FRAME_END 0xC0            // KISS frame delimiter; completes a queued frame
 
 class ArduinoBLESerial {
   public:
@@ -68,6 +46,14 @@ class ArduinoBLESerial {
     bool connected();
     operator bool();
 
+    // getMtu returns the ATT MTU agreed with the connected central;
+    // notifications are filled to mtu - 3 bytes
+    uint16_t getMtu();
+    // setMtu fixes the ATT MTU instead of reading it from ArduinoBLE, for
+    // stacks that report it some other way; zero reads it again. Values are
+    // clamped to BLE_SERIAL_MAX_MTU.
+    void setMtu(uint16_t mtu);
+
   private:
     ArduinoBLESerial();
     ArduinoBLESerial(ArduinoBLESerial const &other) = delete;  // disable copy constructor
@@ -78,8 +64,11 @@ class ArduinoBLESerial {
     size_t numAvailableLines;
 
     unsigned long long lastFlushTime;
-    size_t transmitBufferLength;
-    uint8_t transmitBuffer[BLE_ATTRIBUTE_MAX_VALUE_LENGTH];
+    uint16_t mtu;
+    uint16_t mtuOverride; // set by setMtu; zero when the MTU is read from ATT
+    size_t queuedFrameBytes;
+    ByteRingBuffer<BLE_SERIAL_TRANSMIT_BUFFER_SIZE> transmitBuffer;
+    uint8_t notification[BLE_ATTRIBUTE_MAX_VALUE_LENGTH];
 
     const char* SERVICE_UUID = "6E400001-B5A3-F393-E0A9-E50E24DCCA9E";
     const char* RX_CHAR_UUID = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E";
@@ -91,8 +80,14 @@ class ArduinoBLESerial {
     BLECharacteristic transmitCharacteristic = BLECharacteristic(TX_CHAR_UUID, BLERead | BLENotify, BLE_ATTRIBUTE_MAX_VALUE_LENGTH);
     BLEDescriptor txDescriptor = BLEDescriptor(TX_CHAR_CCCD, "aln:tx");
 
+    void applyMtu(uint16_t mtu);
+    void refreshMtu();
+    size_t payloadSize();
+    void notify(size_t sz);
+    void sendNotifications(bool partial);
     void onReceive(const uint8_t* data, size_t size);
     static void onBLEWritten(BLEDevice central, BLECharacteristic characteristic);
+    static void onBLEConnected(BLEDevice central);
 };
 
 #endif
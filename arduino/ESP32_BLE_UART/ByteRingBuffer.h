@@ -0,0 +1,124 @@
+#ifndef __BYTE_RING_BUFFER_H__
+#define __BYTE_RING_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Single-producer single-consumer byte queue.
+//
+// N must be a power of two so positions wrap with a mask instead of a modulo.
+// head and tail count bytes written and read since the last clear(); their
+// difference is the fill level, so one writer (e.g. a BLE callback) and one
+// reader (the main loop) can share the buffer without a lock. Writes never
+// overwrite unread data; bytes that do not fit are rejected.
+template<size_t N> class ByteRingBuffer {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "ByteRingBuffer size must be a power of two");
+
+  private:
+    uint8_t ringBuffer[N];
+    volatile size_t head = 0;
+    volatile size_t tail = 0;
+
+  public:
+    static const size_t MASK = N - 1;
+
+    bool add(uint8_t value) {
+      if (getFree() == 0) {
+        return false;
+      }
+      ringBuffer[head & MASK] = value;
+      __sync_synchronize();
+      head = head + 1;
+      return true;
+    }
+    int pop() { // pops the oldest value off the ring buffer
+      if (head == tail) {
+        return -1;
+      }
+      uint8_t result = ringBuffer[tail & MASK];
+      __sync_synchronize();
+      tail = tail + 1;
+      return result;
+    }
+    int get(size_t index) { // this.get(0) is the oldest value, this.get(this.getLength() - 1) is the newest value
+      if (index >= getLength()) {
+        return -1;
+      }
+      return ringBuffer[(tail + index) & MASK];
+    }
+
+    // write copies as much of data as fits and returns the number of bytes taken
+    size_t write(const uint8_t* data, size_t sz) {
+      size_t total = 0;
+      while (total < sz) {
+        uint8_t* span;
+        size_t n = writeSpan(&span);
+        if (n == 0) {
+          break;
+        }
+        if (n > sz - total) {
+          n = sz - total;
+        }
+        memcpy(span, data + total, n);
+        commit(n);
+        total += n;
+      }
+      return total;
+    }
+
+    // read moves up to sz of the oldest bytes into out and returns the count
+    size_t read(uint8_t* out, size_t sz) {
+      size_t total = 0;
+      while (total < sz) {
+        const uint8_t* span;
+        size_t n = readSpan(&span);
+        if (n == 0) {
+          break;
+        }
+        if (n > sz - total) {
+          n = sz - total;
+        }
+        memcpy(out + total, span, n);
+        consume(n);
+        total += n;
+      }
+      return total;
+    }
+
+    // readSpan points span at the oldest bytes and returns how many of them are
+    // contiguous in memory; call consume() once they have been used
+    size_t readSpan(const uint8_t** span) {
+      size_t length = getLength();
+      size_t offset = tail & MASK;
+      *span = ringBuffer + offset;
+      return length < N - offset ? length : N - offset;
+    }
+    void consume(size_t n) {
+      __sync_synchronize();
+      tail = tail + n;
+    }
+
+    // writeSpan points span at the next free bytes and returns how many of them
+    // are contiguous in memory; call commit() once they have been filled
+    size_t writeSpan(uint8_t** span) {
+      size_t space = getFree();
+      size_t offset = head & MASK;
+      *span = ringBuffer + offset;
+      return space < N - offset ? space : N - offset;
+    }
+    void commit(size_t n) {
+      __sync_synchronize();
+      head = head + n;
+    }
+
+    void clear() {
+      head = 0;
+      tail = 0;
+    }
+    size_t getLength() { return head - tail; }
+    size_t getFree() { return N - getLength(); }
+    size_t getCapacity() { return N; }
+};
+
+#endif
@@ -12,6 +12,7 @@ products from Adafruit!
 #include "Adafruit_MCP9808.h"
 #include "parser.h"
 #include "framer.h"
+#include "telemetry.h"
 
 #include <WiFiUdp.h>
 
@@ -102,6 +103,20 @@ void handler(Packet* p) {
 
 Parser parser(handler);
 
+// sendTelemetry delivers a batch of readings to the log service
+void sendTelemetry(uint8* data, uint16 sz) {
+  Packet p;
+  p.clear();
+  char srv[] = "log";
+  p.setService((uint8*)srv, 3);
+  p.setSource((uint8*)nodeAddress, 10);
+  p.typ = TELEMETRY_DATATYPE;
+  p.setData(data, sz);
+  sendPacket(&p);
+}
+
+TelemetryBatch telemetry(sendTelemetry);
+
 void setup() {
   //  init serial
   Serial.begin(115200);
@@ -129,6 +144,8 @@ void setup() {
     delay(500);
   }
   Serial.println(WiFi.localIP());
+  telemetry.setFlushInterval(300000); // report at least every five minutes
+  telemetry.setThreshold(0.5);        // or as soon as the temperature moves half a degree
   Udp.begin(udpBroadcastListenPort);
 }
 
@@ -191,21 +208,12 @@ void loop() {
       if (elapsed() > 5000) {
         markTime();
 
-        char data[16];
-        int dataSz = sprintf(data, "%0.3fF", readSensor());
-        Serial.println(data);
-        
-        Packet p;
-        p.clear();
-        char srv[] = "log";
-        p.setService((uint8*)srv, 3);
-        p.setSource((uint8*)nodeAddress, 10);
-        p.setData((uint8*)data, dataSz);
-        sendPacket(&p);        
+        telemetry.append(millis(), readSensor());
       } else if (elapsed() < 0) {
         Serial.println("timer rollover detected, reseting timer");
         markTime();
       }
+      telemetry.poll(millis());
   } else {
     readUdp();
   }
@@ -4,6 +4,9 @@
 typedef unsigned char uint8;
 typedef unsigned short uint16;
 typedef unsigned int uint32;
+typedef signed char int8;
+typedef short int16;
+typedef int int32;
 
 // Packet framing
 #define FRAME_CF_LENGTH 2
@@ -36,6 +39,9 @@ typedef unsigned int uint32;
 #define NET_QUERY   byte(0x03) // packet is a request for content
 #define NET_ERROR   byte(0xFF) // packet is an peer error message
 
+// orders buffer writes against index updates shared with an interrupt handler
+#define ALN_MEMORY_BARRIER() __sync_synchronize()
+
 
 uint16 readUint16(uint8* buffer);
 uint32 readUint32(uint8* buffer);
@@ -51,22 +51,22 @@ void Packet::write(Framer* f) {
   writeUint16(byteBuff, cf);
   writeOut(f, byteBuff, 2);
   if (cf & CF_NETSTATE)
-    f->out(net);
+    f->write(net);
 
   if (cf & CF_SERVICE) {
-    f->out(srvSz);
+    f->write(srvSz);
     writeOut(f, srv, srvSz);
   }
   if (cf & CF_SRCADDR) {
-    f->out(srcSz);
+    f->write(srcSz);
     writeOut(f, src, srcSz);
   }
   if (cf & CF_DESTADDR) {
-    f->out(dstSz);
+    f->write(dstSz);
     writeOut(f, dst, dstSz);
   }
   if (cf & CF_NEXTADDR) {
-    f->out(nxtSz);
+    f->write(nxtSz);
     writeOut(f, nxt, nxtSz);
   }
   if (cf & CF_SEQNUM) {
@@ -82,7 +82,7 @@ void Packet::write(Framer* f) {
     writeOut(f, byteBuff, 2);
   }
   if (cf & CF_DATATYPE) {
-    f->out(typ);
+    f->write(typ);
   }
   if (cf & CF_DATA) {
     writeUint16(byteBuff, dataSz);
@@ -119,7 +119,7 @@ void Packet::setData(uint8* p, int sz) {
 
 void writeOut(Framer* f, uint8* buff, int len) {
   for(int i = 0; i < len; i++) {
-    f->out(buff[i]);
+    f->write(buff[i]);
   }
 }
 
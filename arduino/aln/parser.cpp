@@ -1,88 +1,191 @@
 #include "parser.h"
 
+#define SLOT_MASK (PARSER_SLOTS - 1)
+
 Parser::Parser(void (*handler)(Packet*)) {
-    onPacket = handler;
+	onPacket = handler;
 	reset();
 }
 
-void Parser::ingestFrameBytes(uint8* in, int sz) {
-    for (int i = 0; i < sz; i++) {
-		if (in[i] == FRAME_END) {
-			acceptPacket();
-		} else if (state == STATE_ESCAPED) {
-			switch (in[i]) {
-			case FRAME_END_T:
-				packetBuffer[pBuffIdx++] = FRAME_END;
-			case FRAME_ESC_T:
-				packetBuffer[pBuffIdx++] = FRAME_ESC;
-			}
-			state = STATE_BUFFERING;
-		} else if (in[i] == FRAME_ESC) {
-			state = STATE_ESCAPED;
-		} else {
-			packetBuffer[pBuffIdx++] = in[i];
+void Parser::ingest(uint8 data) {
+	if (data == FRAME_END) {
+		acceptPacket();
+	} else if (state == STATE_DISCARD) {
+		return;
+	} else if (state == STATE_ESCAPED) {
+		switch (data) {
+		case FRAME_END_T:
+			buffer(FRAME_END);
+			break;
+		case FRAME_ESC_T:
+			buffer(FRAME_ESC);
+			break;
 		}
+		if (state == STATE_ESCAPED)
+			state = STATE_BUFFERING;
+	} else if (data == FRAME_ESC) {
+		state = STATE_ESCAPED;
+	} else {
+		buffer(data);
 	}
 }
 
+// buffer appends a byte to the slot being filled, or discards the rest of the
+// frame when every slot is still held by the consumer or the frame is too long
+void Parser::buffer(uint8 data) {
+	if ((uint8)(head - tail) >= PARSER_SLOTS || pBuffIdx >= MAX_PACKET_SZ) {
+		state = STATE_DISCARD;
+		return;
+	}
+	slotBuffer[head & SLOT_MASK][pBuffIdx++] = data;
+}
+
+// acceptPacket publishes the frame being filled to the consumer
 void Parser::acceptPacket() {
-	parsePacket();
-	onPacket(&packet);
-	reset();
+	if (state == STATE_DISCARD) {
+		dropped++;
+	} else if (pBuffIdx > 0) {
+		slotLength[head & SLOT_MASK] = pBuffIdx;
+		ALN_MEMORY_BARRIER();
+		head = head + 1;
+	}
+	pBuffIdx = 0;
+	state = STATE_BUFFERING;
 }
 
+// next returns the oldest completed packet, or 0 if none is waiting. Frames
+// that fail to parse are released and skipped.
+Packet* Parser::next() {
+	while (head != tail) {
+		ALN_MEMORY_BARRIER();
+		uint8 slot = tail & SLOT_MASK;
+		if (parsePacket(slotBuffer[slot], slotLength[slot])) {
+			return &packet;
+		}
+		release();
+	}
+	return 0;
+}
 
-// ParsePacket makes a structured packet from an unframed buffer
-void Parser::parsePacket() {
-	packet.cf = cfHamDecode(readUint16(packetBuffer));
-	uint8 offset = CF_FIELD_SIZE; // length of controlFlags
+// release hands the oldest frame buffer back to the producer
+void Parser::release() {
+	if (head == tail)
+		return;
+	packet.clear();
+	ALN_MEMORY_BARRIER();
+	tail = tail + 1;
+}
+
+// poll dispatches every completed packet to the handler
+void Parser::poll() {
+	Packet* p;
+	while ((p = next()) != 0) {
+		if (onPacket)
+			onPacket(p);
+		release();
+	}
+}
+
+void Parser::ingestFrameBytes(uint8* in, int sz) {
+	for (int i = 0; i < sz; i++) {
+		ingest(in[i]);
+		if (in[i] == FRAME_END)
+			poll();
+	}
+}
+
+uint8 Parser::pending() {
+	return head - tail;
+}
+
+uint16 Parser::droppedFrames() {
+	return dropped;
+}
+
+
+// ParsePacket makes a structured packet from an unframed buffer. Every field
+// is checked against length before it is read, so a truncated or corrupt frame
+// is rejected rather than read past its end.
+bool Parser::parsePacket(uint8* buffer, uint16 length) {
+	packet.clear();
+	if (length < CF_FIELD_SIZE)
+		return false;
+	packet.cf = cfHamDecode(readUint16(buffer));
+	uint32 offset = CF_FIELD_SIZE; // length of controlFlags
 	if (packet.cf&CF_NETSTATE) {
-		packet.net = packetBuffer[offset++];
+		if (offset + NETSTATE_FIELD_SIZE > length)
+			return false;
+		packet.net = buffer[offset++];
 	}
 	if (packet.cf&CF_SERVICE) {
-		packet.srvSz = packetBuffer[offset++];
-		packet.srv = packetBuffer+offset;
+		if (offset + 1 > length || offset + 1 + buffer[offset] > length)
+			return false;
+		packet.srvSz = buffer[offset++];
+		packet.srv = buffer+offset;
 		offset += packet.srvSz;
 	}
 	if (packet.cf&CF_SRCADDR) {
-		uint8 addrSize = packetBuffer[offset++];
-		packet.src = packetBuffer+offset;
-		offset += addrSize;
+		if (offset + 1 > length || offset + 1 + buffer[offset] > length)
+			return false;
+		packet.srcSz = buffer[offset++];
+		packet.src = buffer+offset;
+		offset += packet.srcSz;
 	}
 	if (packet.cf&CF_DESTADDR) {
-		packet.dstSz = packetBuffer[offset++];
-		packet.dst = packetBuffer+offset;
+		if (offset + 1 > length || offset + 1 + buffer[offset] > length)
+			return false;
+		packet.dstSz = buffer[offset++];
+		packet.dst = buffer+offset;
 		offset += packet.dstSz;
 	}
 	if (packet.cf&CF_NEXTADDR) {
-		packet.nxtSz = packetBuffer[offset++];
-		packet.nxt = packetBuffer+offset;
+		if (offset + 1 > length || offset + 1 + buffer[offset] > length)
+			return false;
+		packet.nxtSz = buffer[offset++];
+		packet.nxt = buffer+offset;
 		offset += packet.nxtSz;
 	}
 	if (packet.cf&CF_SEQNUM) {
-		packet.seq = readUint16(packetBuffer+offset);
+		if (offset + SEQNUM_FIELD_SIZE > length)
+			return false;
+		packet.seq = readUint16(buffer+offset);
 		offset += SEQNUM_FIELD_SIZE;
 	}
 	if (packet.cf&CF_ACKBLOCK) {
-		packet.ack = readUint32(packetBuffer+offset);
+		if (offset + ACKBLOCK_FIELD_SIZE > length)
+			return false;
+		packet.ack = readUint32(buffer+offset);
 		offset += ACKBLOCK_FIELD_SIZE;
 	}
 	if (packet.cf&CF_CONTEXTID) {
-		packet.ctx = readUint16(packetBuffer+offset);
+		if (offset + CONTEXTID_FIELD_SIZE > length)
+			return false;
+		packet.ctx = readUint16(buffer+offset);
 		offset += CONTEXTID_FIELD_SIZE;
 	}
 	if (packet.cf&CF_DATATYPE) {
-		packet.typ = packetBuffer[offset++];
+		if (offset + DATATYPE_FIELD_SIZE > length)
+			return false;
+		packet.typ = buffer[offset++];
 	}
 	if (packet.cf&CF_DATA) {
-		packet.dataSz = readUint16(packetBuffer+offset);
+		if (offset + DATALENGTH_FIELD_SIZE > length)
+			return false;
+		packet.dataSz = readUint16(buffer+offset);
 		offset += DATALENGTH_FIELD_SIZE;
-		packet.data = packetBuffer+offset;
+		if (offset + packet.dataSz > length)
+			return false;
+		packet.data = buffer+offset;
+		offset += packet.dataSz;
 	}
+	return true;
 }
 
 void Parser::reset() {
 	packet.clear();
+	head = 0;
+	tail = 0;
 	pBuffIdx = 0;
+	dropped = 0;
 	state = STATE_BUFFERING;
-}
\ No newline at end of file
+}
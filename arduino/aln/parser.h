@@ -4,25 +4,71 @@
 #include "packet.h"
 #include "framer.h"
 
+#ifndef MAX_PACKET_SZ
 #define MAX_PACKET_SZ 1024
+#endif
+
+// number of frame buffers in the receive ring; must be a power of two.
+// one slot is filled by ingest() while the others hold completed frames
+// waiting for the main loop. AVR boards have too little RAM for two
+// MAX_PACKET_SZ buffers, so they keep one by default: frames arriving while
+// the main loop holds the last one are dropped, as before the ring.
+#ifndef PARSER_SLOTS
+#ifdef __AVR__
+#define PARSER_SLOTS 1
+#else
+#define PARSER_SLOTS 2
+#endif
+#endif
+
+#if (PARSER_SLOTS & (PARSER_SLOTS - 1)) != 0 || PARSER_SLOTS > 128
+#error "PARSER_SLOTS must be a power of two no larger than 128"
+#endif
 
 const uint8 STATE_BUFFERING = 0;
 const uint8 STATE_ESCAPED = 1;
+const uint8 STATE_DISCARD = 2;
 
-
+// Parser decodes KISS framed bytes into packets.
+//
+// ingest() is the producer side and may be called from a UART or BLE receive
+// interrupt; next()/release() (or poll()) are the consumer side and run in the
+// main loop. Completed frames are handed off through the free-running head and
+// tail counters so neither side has to disable interrupts. A Packet returned
+// by next() points into its frame buffer and stays valid until release().
 class Parser {
 private:
-    uint8 packetBuffer[MAX_PACKET_SZ];
-    uint8 pBuffIdx;
-    Packet packet;
+    uint8 slotBuffer[PARSER_SLOTS][MAX_PACKET_SZ];
+    uint16 slotLength[PARSER_SLOTS];
+    volatile uint8 head; // frames completed by the producer
+    volatile uint8 tail; // frames released by the consumer
+    uint16 pBuffIdx;
     uint8 state;
+    uint16 dropped;
+    Packet packet;
     void (*onPacket)(Packet*);
 
+    void buffer(uint8 data);
+    bool parsePacket(uint8* buffer, uint16 length);
+
 public:
-    Parser(void (*handler)(Packet*));
-    void ingestFrameBytes(uint8* in, int sz);
+    Parser(void (*handler)(Packet*) = 0);
+
+    // producer side; safe to call from an interrupt
+    void ingest(uint8 data);
     void acceptPacket();
-    void parsePacket();
+
+    // consumer side; main loop only
+    Packet* next();
+    void release();
+    void poll();
+
+    // ingests bytes and dispatches each completed packet to the handler;
+    // for parsers fed from the main loop rather than an interrupt
+    void ingestFrameBytes(uint8* in, int sz);
+
+    uint8 pending();
+    uint16 droppedFrames();
     void reset();
 };
 
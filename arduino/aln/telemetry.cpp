@@ -0,0 +1,100 @@
+#include "telemetry.h"
+
+TelemetryBatch::TelemetryBatch(void (*out)(uint8*, uint16), uint8 decimals, uint16 tickMs) {
+    this->out = out;
+    this->decimals = decimals;
+    this->tickMs = tickMs > 0 ? tickMs : 1;
+    flushInterval = 60000;
+    threshold = 0;
+    count = 0;
+    payloadSz = 0;
+    lastTime = 0;
+    lastValue = 0;
+}
+
+void TelemetryBatch::setFlushInterval(uint32 ms) {
+    flushInterval = ms;
+}
+
+// setThreshold sets the change between consecutive readings that flushes the
+// batch immediately; zero disables change-triggered flushes
+void TelemetryBatch::setThreshold(float delta) {
+    int16 fixed = toFixedPoint(delta < 0 ? -delta : delta);
+    threshold = fixed;
+}
+
+int16 TelemetryBatch::toFixedPoint(float value) {
+    for (uint8 i = 0; i < decimals; i++)
+        value *= 10;
+    value += value < 0 ? -0.5f : 0.5f;
+    if (value > 32767)
+        return 32767;
+    if (value < -32768)
+        return -32768;
+    return (int16)value;
+}
+
+void TelemetryBatch::begin(uint32 now, int16 value) {
+    payload[0] = TELEMETRY_VERSION;
+    payload[1] = decimals;
+    writeUint16(payload + 2, tickMs);
+    writeUint32(payload + 4, now);
+    writeUint16(payload + 8, (uint16)value);
+    payloadSz = TELEMETRY_HEADER_SIZE;
+    count = 1;
+    lastTime = now;
+    lastValue = value;
+}
+
+bool TelemetryBatch::append(uint32 now, float value) {
+    int16 fixed = toFixedPoint(value);
+    if (count == 0) {
+        begin(now, fixed);
+        return false;
+    }
+
+    bool flushed = false;
+    int32 change = (int32)fixed - lastValue;
+    uint32 ticks = (now - lastTime + tickMs / 2) / tickMs;
+    if (ticks > 0xFF || change > 127 || change < -128) {
+        flushed = flush();
+        begin(now, fixed);
+    } else {
+        payload[payloadSz++] = (uint8)ticks;
+        payload[payloadSz++] = (uint8)(int8)change;
+        lastTime += ticks * tickMs; // track the decoded time so rounding does not drift
+        lastValue = fixed;
+        count++;
+    }
+
+    uint16 magnitude = change < 0 ? -change : change;
+    if (count == TELEMETRY_MAX_SAMPLES || (threshold > 0 && magnitude > threshold)) {
+        flushed = flush() || flushed;
+    }
+    return flushed;
+}
+
+bool TelemetryBatch::poll(uint32 now) {
+    if (count == 0)
+        return false;
+    if (now - readUint32(payload + 4) < flushInterval)
+        return false;
+    return flush();
+}
+
+bool TelemetryBatch::flush() {
+    if (count == 0)
+        return false;
+    out(payload, payloadSz);
+    count = 0;
+    payloadSz = 0;
+    return true;
+}
+
+uint8 TelemetryBatch::sampleCount() {
+    return count;
+}
+
+uint16 TelemetryBatch::size() {
+    return payloadSz;
+}
@@ -0,0 +1,61 @@
+#ifndef ALN_TELEMETRY_H
+#define ALN_TELEMETRY_H
+
+#include "alntypes.h"
+
+// Packet data type of a telemetry batch payload
+#define TELEMETRY_DATATYPE 0x54
+
+// Telemetry batch payload layout (big endian)
+//   version    uint8   TELEMETRY_VERSION
+//   decimals   uint8   values are fixed point with this many decimal places
+//   tickMs     uint16  unit of the sample time deltas
+//   baseTime   uint32  millis() of the first sample
+//   baseValue  int16   fixed point value of the first sample
+//   samples    [uint8 ticks since previous sample, int8 change since previous sample]
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HEADER_SIZE 10
+#define TELEMETRY_SAMPLE_SIZE 2
+
+#ifndef TELEMETRY_MAX_SAMPLES
+#define TELEMETRY_MAX_SAMPLES 64
+#endif
+
+#define TELEMETRY_PAYLOAD_SZ (TELEMETRY_HEADER_SIZE + (TELEMETRY_MAX_SAMPLES - 1) * TELEMETRY_SAMPLE_SIZE)
+
+// TelemetryBatch accumulates readings into a preallocated payload and hands it
+// to the flush callback when the batch is full, when the oldest sample is older
+// than the flush interval, or when a reading moves by more than the threshold.
+// A sample that does not fit the delta encoding starts a new batch.
+class TelemetryBatch {
+private:
+    uint8 payload[TELEMETRY_PAYLOAD_SZ];
+    uint16 payloadSz;
+    uint8 count;
+    uint8 decimals;
+    uint16 tickMs;
+    uint32 flushInterval;
+    uint16 threshold;
+    uint32 lastTime;
+    int16 lastValue;
+    void (*out)(uint8* data, uint16 sz);
+
+    int16 toFixedPoint(float value);
+    void begin(uint32 now, int16 value);
+
+public:
+    TelemetryBatch(void (*out)(uint8* data, uint16 sz), uint8 decimals = 2, uint16 tickMs = 100);
+    void setFlushInterval(uint32 ms);
+    void setThreshold(float delta);
+
+    // append adds a reading taken at now (millis); returns true if a batch was flushed
+    bool append(uint32 now, float value);
+    // poll flushes the batch once its time budget has expired
+    bool poll(uint32 now);
+    bool flush();
+
+    uint8 sampleCount();
+    uint16 size();
+};
+
+#endif
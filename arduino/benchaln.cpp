@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+#include "./aln/parser.h"
+#include "./aln/telemetry.h"
+
+// host-side throughput and footprint report for the arduino aln library
+#define ITERATIONS 200000
+
+uint8 frameBuffer[4096];
+int frameSz = 0;
+void bufferWriter(uint8 data) {
+    frameBuffer[frameSz++] = data;
+}
+
+// unframe undoes the framer's escaping of a frame of sz bytes into raw,
+// returning the length of the packet's serialization
+int unframe(const uint8* frame, int sz, uint8* raw) {
+    int n = 0;
+    for (int i = 0; i < sz; i++) {
+        if (frame[i] == FRAME_END)
+            continue;
+        if (frame[i] == FRAME_ESC && i + 1 < sz)
+            raw[n++] = frame[++i] == FRAME_END_T ? FRAME_END : FRAME_ESC;
+        else
+            raw[n++] = frame[i];
+    }
+    return n;
+}
+
+Parser parser;
+int packetsParsed = 0;
+
+struct Timer {
+    struct timespec start;
+#ifdef HAVE_RDTSC
+    unsigned long long cycles;
+#endif
+    void begin() {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef HAVE_RDTSC
+        cycles = __rdtsc();
+#endif
+    }
+    void report(const char* stage, long long bytes) {
+#ifdef HAVE_RDTSC
+        unsigned long long elapsedCycles = __rdtsc() - cycles;
+#endif
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        printf("  %-8s %8.1f MB/s %7.2f ns/B", stage, bytes / seconds / 1e6, seconds * 1e9 / bytes);
+#ifdef HAVE_RDTSC
+        printf(" %7.2f cyc/B", (double)elapsedCycles / bytes);
+#endif
+        printf("\n");
+    }
+};
+
+void bench(const char* name, Packet* packet) {
+    frameSz = 0;
+    Framer framer(bufferWriter);
+    packet->write(&framer);
+    framer.end();
+    int wireSz = frameSz;
+    printf("%s: %d bytes framed\n", name, wireSz);
+
+    Timer t;
+
+    // encode: serialize the packet through the framer
+    t.begin();
+    for (int i = 0; i < ITERATIONS; i++) {
+        frameSz = 0;
+        packet->write(&framer);
+        framer.end();
+    }
+    t.report("encode", (long long)wireSz * ITERATIONS);
+
+    // frame: the framer's share of encode, escaping the packet's serialized
+    // bytes as Packet::write hands them over
+    uint8 raw[sizeof(frameBuffer)];
+    int rawSz = unframe(frameBuffer, wireSz, raw);
+    t.begin();
+    for (int i = 0; i < ITERATIONS; i++) {
+        frameSz = 0;
+        for (int j = 0; j < rawSz; j++)
+            framer.write(raw[j]);
+        framer.end();
+    }
+    t.report("frame", (long long)wireSz * ITERATIONS);
+    if (frameSz != wireSz)
+        printf("  frame: %d bytes out, encode wrote %d\n", frameSz, wireSz);
+
+    // restore the framed packet for the receive side
+    frameSz = 0;
+    packet->write(&framer);
+    framer.end();
+
+    // parse: unescape frame bytes into the receive ring
+    t.begin();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < wireSz; j++)
+            parser.ingest(frameBuffer[j]);
+        parser.release(); // drop the frame undecoded
+    }
+    t.report("parse", (long long)wireSz * ITERATIONS);
+
+    // decode: structure completed frames into packets
+    t.begin();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < wireSz; j++)
+            parser.ingest(frameBuffer[j]);
+        Packet* p = parser.next();
+        if (p && p->dataSz == packet->dataSz && memcmp(p->data, packet->data, p->dataSz) == 0)
+            packetsParsed++;
+        parser.release();
+    }
+    t.report("decode", (long long)wireSz * ITERATIONS);
+}
+
+int main() {
+    uint8 uuidA[] = "0b1a6e2c-4f3d-4e8b-9a51-2c7d9e0f1a2b";
+    uint8 uuidB[] = "7f2e91d4-08c3-4b6a-b5e2-9d4c1f7a3e60";
+    uint8 nodeAddress[] = "ESP32-black-box";
+    uint8 srv[] = "log";
+
+    // route advertisement: net state with a short payload
+    uint8 routeData[40];
+    routeData[0] = 36;
+    memcpy(routeData + 1, uuidB, 36);
+    writeUint16(routeData + 37, 2);
+    Packet route;
+    route.clear();
+    route.net = 0x01;
+    route.setSource(uuidA, 36);
+    route.setData(routeData, 39);
+    bench("route share", &route);
+
+    // telemetry batch sent to the log service
+    uint8 telemetry[TELEMETRY_PAYLOAD_SZ];
+    for (int i = 0; i < TELEMETRY_PAYLOAD_SZ; i++)
+        telemetry[i] = (i * 7) & 0xFF;
+    Packet log;
+    log.clear();
+    log.setService(srv, 3);
+    log.setSource(nodeAddress, 15);
+    log.typ = TELEMETRY_DATATYPE;
+    log.setData(telemetry, TELEMETRY_PAYLOAD_SZ);
+    bench("telemetry", &log);
+
+    // service request with binary content, including bytes that need escaping
+    uint8 content[512];
+    for (int i = 0; i < 512; i++)
+        content[i] = (i * 31 + 7) & 0xFF;
+    Packet request;
+    request.clear();
+    request.setService(srv, 3);
+    request.setSource(uuidA, 36);
+    request.setDest(uuidB, 36);
+    request.ctx = 4242;
+    request.setData(content, 512);
+    bench("request", &request);
+
+    printf("decoded %d of %d packets intact\n", packetsParsed, 3 * ITERATIONS);
+
+    printf("object sizes:\n");
+    printf("  Parser          %6d bytes (%d x %d byte frame slots)\n",
+        (int)sizeof(Parser), PARSER_SLOTS, MAX_PACKET_SZ);
+    printf("  Packet          %6d bytes\n", (int)sizeof(Packet));
+    printf("  Framer          %6d bytes\n", (int)sizeof(Framer));
+    printf("  TelemetryBatch  %6d bytes\n", (int)sizeof(TelemetryBatch));
+    return packetsParsed == 3 * ITERATIONS ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "./aln/parser.h"
+#include "./aln/telemetry.h"
 
 // used to generate test frame feed into a parser and 
 // expect a call to our packet handler
@@ -17,6 +18,11 @@ void handler(Packet* p) {
     received = true;
 }
 
+int telemetrySz = 0;
+void telemetryWriter(uint8*, uint16 sz) {
+    telemetrySz = sz;
+}
+
 
 int main() {
     uint8 destAddr[] = "test";
@@ -43,5 +49,46 @@ int main() {
 
     printf("received %d\n", received);
 
+    // bytes ingested as if from a receive interrupt are held until the
+    // main loop polls; a second frame is buffered in the other slot
+    int received_count = 0;
+    Parser isrParser;
+    for (int i = 0; i < idx; i++)
+        isrParser.ingest(frameBuffer[i]);
+    for (int i = 0; i < idx; i++)
+        isrParser.ingest(frameBuffer[i]);
+    printf("pending %d\n", isrParser.pending());
+    while (Packet* p = isrParser.next()) {
+        printf("packet polled, dst: %d %.*s\n", p->dstSz, p->dstSz, p->dst);
+        received_count++;
+        isrParser.release();
+    }
+    printf("polled %d\n", received_count);
+
+    // every truncation of a frame is rejected rather than read past its end
+    uint8 payload[] = "payload";
+    packet.setData(payload, 7);
+    packet.ctx = 42;
+    idx = 0;
+    packet.write(&f);
+    int full = idx;
+    int rejected = 0;
+    for (int cut = 1; cut < full; cut++) {
+        Parser truncated;
+        for (int i = 0; i < cut; i++)
+            truncated.ingest(frameBuffer[i]);
+        truncated.acceptPacket();
+        if (truncated.next() == 0)
+            rejected++;
+    }
+    printf("truncated frames rejected %d of %d\n", rejected, full - 1);
+
+    // a minute of 2s temperature readings batches into a single payload
+    TelemetryBatch batch(telemetryWriter);
+    for (int i = 0; i < 30; i++)
+        batch.append(i * 2000, 72.0f + (i % 3) * 0.05f);
+    batch.flush();
+    printf("telemetry batch of 30 samples: %d bytes\n", telemetrySz);
+
     return 0;
 }
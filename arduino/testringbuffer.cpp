@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <time.h>
+#include "./ESP32_BLE_UART/ByteRingBuffer.h"
+
+// host-side checks and a throughput comparison for the BLE serial ring buffer
+int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { \
+    printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void testByteOps() {
+    ByteRingBuffer<8> rb;
+    CHECK(rb.pop() == -1);
+    for (int i = 0; i < 8; i++)
+        CHECK(rb.add(i));
+    CHECK(!rb.add(99)); // full buffers reject rather than overwrite
+    CHECK(rb.getLength() == 8);
+    CHECK(rb.get(0) == 0 && rb.get(7) == 7 && rb.get(8) == -1);
+    for (int i = 0; i < 8; i++)
+        CHECK(rb.pop() == i);
+    CHECK(rb.getLength() == 0);
+}
+
+void testBulkWrap() {
+    ByteRingBuffer<16> rb;
+    uint8_t in[32], out[32];
+    for (int i = 0; i < 32; i++)
+        in[i] = i;
+
+    // move the indices so the next write straddles the end of the array
+    CHECK(rb.write(in, 12) == 12);
+    CHECK(rb.read(out, 12) == 12);
+    CHECK(rb.write(in, 32) == 16);
+    CHECK(rb.getFree() == 0);
+
+    const uint8_t* span;
+    CHECK(rb.readSpan(&span) == 4); // contiguous up to the physical end
+    CHECK(span[0] == 0 && span[3] == 3);
+
+    CHECK(rb.read(out, 32) == 16);
+    for (int i = 0; i < 16; i++)
+        CHECK(out[i] == i);
+
+    uint8_t* wspan;
+    CHECK(rb.writeSpan(&wspan) == 4);
+    wspan[0] = 42;
+    rb.commit(1);
+    CHECK(rb.pop() == 42);
+}
+
+ByteRingBuffer<1024> benchBuffer;
+
+void benchmark() {
+    const size_t total = 64 * 1024 * 1024;
+    const size_t chunk = 244; // one notification at a 247 byte MTU
+    ByteRingBuffer<1024>& rb = benchBuffer;
+    uint8_t in[chunk], out[chunk];
+    for (size_t i = 0; i < chunk; i++)
+        in[i] = i;
+    unsigned sink = 0;
+
+    double start = now();
+    for (size_t moved = 0; moved < total; moved += chunk) {
+        for (size_t i = 0; i < chunk; i++)
+            rb.add(in[i]);
+        for (size_t i = 0; i < chunk; i++)
+            sink += rb.pop();
+    }
+    double perByte = now() - start;
+
+    start = now();
+    for (size_t moved = 0; moved < total; moved += chunk) {
+        rb.write(in, chunk);
+        sink += rb.read(out, chunk) + out[0];
+    }
+    double bulk = now() - start;
+
+    printf("ring buffer add/pop:    %7.1f MB/s\n", total / perByte / 1e6);
+    printf("ring buffer write/read: %7.1f MB/s (sink %u)\n", total / bulk / 1e6, sink & 1);
+}
+
+int main() {
+    testByteOps();
+    testBulkWrap();
+    benchmark();
+    printf("failures %d\n", failures);
+    return failures != 0;
+}